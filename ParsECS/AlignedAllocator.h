@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/// Strictest alignment a component state or column may ask for, one cache line.
+#define PARSECS_MAX_STATE_ALIGNMENT 64
+
+/// Rounds value up to a multiple of alignment, which must be a power of two.
+inline size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/// Allocates memory at the given power of two alignment, release it with AlignedFree.
+inline void* AlignedAllocate(size_t size, size_t alignment)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    void* memory = 0x0;
+    if (posix_memalign(&memory, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+        return 0x0;
+    return memory;
+#endif
+}
+
+inline void AlignedFree(void* memory)
+{
+#if defined(_MSC_VER)
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+/// Standard allocator whose storage starts on an ALIGNMENT byte boundary, for containers of raw state bytes
+/// that are accessed as typed states.
+template<typename T, size_t ALIGNMENT = PARSECS_MAX_STATE_ALIGNMENT>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+    AlignedAllocator() { }
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&) { }
+
+    T* allocate(size_t count)
+    {
+        if (void* memory = AlignedAllocate(count * sizeof(T), ALIGNMENT))
+            return (T*)memory;
+        throw std::bad_alloc();
+    }
+    void deallocate(T* memory, size_t) { AlignedFree(memory); }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, ALIGNMENT>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, ALIGNMENT>&) const { return false; }
+};
\ No newline at end of file
@@ -3,13 +3,13 @@
 #include "ComponentCount.h"
 #include "Offsets.h"
 
-#include <bitset>
+#include <vector>
 
 struct Aspect
 {
-    std::bitset<PARSECS_COMPONENT_COUNT> requireMask_;
-    std::bitset<PARSECS_COMPONENT_COUNT> excludeMask_;
-    std::bitset<PARSECS_COMPONENT_COUNT> oneOf_;
+    ComponentBits requireMask_;
+    ComponentBits excludeMask_;
+    ComponentBits oneOf_;
 
     template<typename...TList>
     Aspect& OneOf()
@@ -32,12 +32,48 @@ struct Aspect
         return *this;
     }
 
-    bool Passes(const std::bitset<PARSECS_COMPONENT_COUNT>& mask) const
+    bool operator==(const Aspect& rhs) const { return requireMask_ == rhs.requireMask_ && excludeMask_ == rhs.excludeMask_ && oneOf_ == rhs.oneOf_; }
+    bool operator!=(const Aspect& rhs) const { return !(*this == rhs); }
+
+    /// Passes if the mask has all required components, none of the excluded, and at least one of oneOf when any are listed.
+    bool Passes(const ComponentBits& mask) const
+    {
+        return MaskPasses(mask, requireMask_, excludeMask_, oneOf_);
+    }
+
+    /// Tests a contiguous array of masks, writing whether each passes. Returns the number that passed.
+    /// Several masks are tested per iteration on the vector paths, prefer this to calling Passes per mask.
+    size_t Passes(const ComponentBits* masks, size_t count, bool* results) const
+    {
+        return MasksPass(masks, count, requireMask_, excludeMask_, oneOf_, results);
+    }
+
+    /// Appends the objects (anything with a mask_ member, e.g. Entity or EntityDefinition) whose mask passes.
+    template<typename T>
+    size_t Select(T* const* objects, size_t count, std::vector<T*>& passed) const
+    {
+        const size_t start = passed.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (MaskPasses(objects[i]->mask_, requireMask_, excludeMask_, oneOf_))
+                passed.push_back(objects[i]);
+        }
+        return passed.size() - start;
+    }
+};
+
+/// Hasher for keying containers by aspect.
+struct AspectHash
+{
+    size_t operator()(const Aspect& aspect) const
     {
-        if (requireMask_.count() && !(requireMask_ & mask).all())
-            return false;
-        if (excludeMask_.count() && (excludeMask_ & mask).any())
-            return false;
-        return (oneOf_ & mask).any();
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < ComponentBits::WordCount; ++i)
+        {
+            hash = (hash ^ aspect.requireMask_.words_[i]) * 1099511628211ull;
+            hash = (hash ^ aspect.excludeMask_.words_[i]) * 1099511628211ull;
+            hash = (hash ^ aspect.oneOf_.words_[i]) * 1099511628211ull;
+        }
+        return (size_t)hash;
     }
 };
\ No newline at end of file
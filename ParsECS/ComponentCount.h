@@ -1,22 +1,280 @@
 #pragma once
 
-#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 
-#define PARSECS_COMPONENT_COUNT 32
+/// Number of component types, must be a multiple of 64. May be defined by the build to raise the limit.
+#ifndef PARSECS_COMPONENT_COUNT
+#define PARSECS_COMPONENT_COUNT 256
+#endif
 
-typedef std::bitset<PARSECS_COMPONENT_COUNT> ComponentBits;
+static_assert(PARSECS_COMPONENT_COUNT > 0 && PARSECS_COMPONENT_COUNT % 64 == 0, "PARSECS_COMPONENT_COUNT must be a multiple of 64");
 
-inline unsigned FlatIndex(const ComponentBits& referenceBits, size_t index)
+// Vector paths for mask operations, define PARSECS_NO_SIMD to force the scalar code
+#if !defined(PARSECS_NO_SIMD)
+    #if defined(__AVX2__)
+        #define PARSECS_SIMD_AVX2 1
+    #endif
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define PARSECS_SIMD_SSE2 1
+    #endif
+#endif
+
+#if defined(PARSECS_SIMD_AVX2)
+    #include <immintrin.h>
+#elif defined(PARSECS_SIMD_SSE2)
+    #include <emmintrin.h>
+#endif
+
+inline unsigned PopCount64(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (unsigned)((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/// Fixed width set of component type bits stored as 64-bit words.
+/// Keeps the subset of the std::bitset interface the ECS uses, plus the subset tests that masks are mostly used for.
+struct ComponentBits
+{
+    static const size_t BitCount = PARSECS_COMPONENT_COUNT;
+    static const size_t WordCount = PARSECS_COMPONENT_COUNT / 64;
+
+    uint64_t words_[WordCount];
+
+    ComponentBits() { for (size_t i = 0; i < WordCount; ++i) words_[i] = 0; }
+
+    size_t size() const { return BitCount; }
+    bool test(size_t index) const { return (words_[index >> 6] >> (index & 63)) & 1; }
+    bool operator[](size_t index) const { return test(index); }
+    ComponentBits& set(size_t index, bool value = true)
+    {
+        const uint64_t bit = 1ull << (index & 63);
+        words_[index >> 6] = value ? (words_[index >> 6] | bit) : (words_[index >> 6] & ~bit);
+        return *this;
+    }
+    ComponentBits& reset(size_t index) { return set(index, false); }
+    ComponentBits& reset() { for (size_t i = 0; i < WordCount; ++i) words_[i] = 0; return *this; }
+
+    /// Number of set bits.
+    size_t count() const
+    {
+        size_t sum = 0;
+        for (size_t i = 0; i < WordCount; ++i)
+            sum += PopCount64(words_[i]);
+        return sum;
+    }
+    /// Number of set bits below the given index.
+    unsigned CountBelow(size_t index) const
+    {
+        unsigned sum = 0;
+        const size_t word = index >> 6;
+        for (size_t i = 0; i < word && i < WordCount; ++i)
+            sum += PopCount64(words_[i]);
+        if (word < WordCount && (index & 63))
+            sum += PopCount64(words_[word] & ((1ull << (index & 63)) - 1));
+        return sum;
+    }
+    bool any() const
+    {
+        uint64_t accum = 0;
+        for (size_t i = 0; i < WordCount; ++i)
+            accum |= words_[i];
+        return accum != 0;
+    }
+    bool none() const { return !any(); }
+    bool all() const
+    {
+        uint64_t accum = ~0ull;
+        for (size_t i = 0; i < WordCount; ++i)
+            accum &= words_[i];
+        return accum == ~0ull;
+    }
+
+    /// Returns true if every bit of other is also set here.
+    bool Contains(const ComponentBits& other) const
+    {
+        uint64_t missing = 0;
+        for (size_t i = 0; i < WordCount; ++i)
+            missing |= other.words_[i] & ~words_[i];
+        return missing == 0;
+    }
+    /// Returns true if any bit is set in both.
+    bool Intersects(const ComponentBits& other) const
+    {
+        uint64_t shared = 0;
+        for (size_t i = 0; i < WordCount; ++i)
+            shared |= other.words_[i] & words_[i];
+        return shared != 0;
+    }
+
+    ComponentBits& operator&=(const ComponentBits& rhs) { for (size_t i = 0; i < WordCount; ++i) words_[i] &= rhs.words_[i]; return *this; }
+    ComponentBits& operator|=(const ComponentBits& rhs) { for (size_t i = 0; i < WordCount; ++i) words_[i] |= rhs.words_[i]; return *this; }
+    ComponentBits& operator^=(const ComponentBits& rhs) { for (size_t i = 0; i < WordCount; ++i) words_[i] ^= rhs.words_[i]; return *this; }
+    ComponentBits operator~() const { ComponentBits ret; for (size_t i = 0; i < WordCount; ++i) ret.words_[i] = ~words_[i]; return ret; }
+    ComponentBits operator&(const ComponentBits& rhs) const { ComponentBits ret(*this); return ret &= rhs; }
+    ComponentBits operator|(const ComponentBits& rhs) const { ComponentBits ret(*this); return ret |= rhs; }
+    ComponentBits operator^(const ComponentBits& rhs) const { ComponentBits ret(*this); return ret ^= rhs; }
+    bool operator==(const ComponentBits& rhs) const
+    {
+        uint64_t diff = 0;
+        for (size_t i = 0; i < WordCount; ++i)
+            diff |= words_[i] ^ rhs.words_[i];
+        return diff == 0;
+    }
+    bool operator!=(const ComponentBits& rhs) const { return !(*this == rhs); }
+};
+
+/// Tests a mask in a single pass: it must contain all of require, none of exclude, and any of oneOf unless oneOf is empty.
+inline bool MaskPasses(const ComponentBits& mask, const ComponentBits& require, const ComponentBits& exclude, const ComponentBits& oneOf)
+{
+    size_t i = 0;
+    bool missing = false, excluded = false, hit = false, constrained = false;
+#if defined(PARSECS_SIMD_AVX2)
+    if (ComponentBits::WordCount >= 4)
+    {
+        __m256i missingV = _mm256_setzero_si256(), excludedV = missingV, hitV = missingV, oneOfV = missingV;
+        for (; i + 4 <= ComponentBits::WordCount; i += 4)
+        {
+            const __m256i m = _mm256_loadu_si256((const __m256i*)(mask.words_ + i));
+            const __m256i o = _mm256_loadu_si256((const __m256i*)(oneOf.words_ + i));
+            missingV = _mm256_or_si256(missingV, _mm256_andnot_si256(m, _mm256_loadu_si256((const __m256i*)(require.words_ + i))));
+            excludedV = _mm256_or_si256(excludedV, _mm256_and_si256(m, _mm256_loadu_si256((const __m256i*)(exclude.words_ + i))));
+            hitV = _mm256_or_si256(hitV, _mm256_and_si256(m, o));
+            oneOfV = _mm256_or_si256(oneOfV, o);
+        }
+        missing = !_mm256_testz_si256(missingV, missingV);
+        excluded = !_mm256_testz_si256(excludedV, excludedV);
+        hit = !_mm256_testz_si256(hitV, hitV);
+        constrained = !_mm256_testz_si256(oneOfV, oneOfV);
+    }
+#endif
+#if defined(PARSECS_SIMD_SSE2)
+    if (i + 2 <= ComponentBits::WordCount)
+    {
+        __m128i missingV = _mm_setzero_si128(), excludedV = missingV, hitV = missingV, oneOfV = missingV;
+        for (; i + 2 <= ComponentBits::WordCount; i += 2)
+        {
+            const __m128i m = _mm_loadu_si128((const __m128i*)(mask.words_ + i));
+            const __m128i o = _mm_loadu_si128((const __m128i*)(oneOf.words_ + i));
+            missingV = _mm_or_si128(missingV, _mm_andnot_si128(m, _mm_loadu_si128((const __m128i*)(require.words_ + i))));
+            excludedV = _mm_or_si128(excludedV, _mm_and_si128(m, _mm_loadu_si128((const __m128i*)(exclude.words_ + i))));
+            hitV = _mm_or_si128(hitV, _mm_and_si128(m, o));
+            oneOfV = _mm_or_si128(oneOfV, o);
+        }
+        // No SSE4.1 ptest, compare against zero instead
+        const __m128i zero = _mm_setzero_si128();
+        missing |= _mm_movemask_epi8(_mm_cmpeq_epi8(missingV, zero)) != 0xFFFF;
+        excluded |= _mm_movemask_epi8(_mm_cmpeq_epi8(excludedV, zero)) != 0xFFFF;
+        hit |= _mm_movemask_epi8(_mm_cmpeq_epi8(hitV, zero)) != 0xFFFF;
+        constrained |= _mm_movemask_epi8(_mm_cmpeq_epi8(oneOfV, zero)) != 0xFFFF;
+    }
+#endif
+    for (; i < ComponentBits::WordCount; ++i)
+    {
+        missing |= (require.words_[i] & ~mask.words_[i]) != 0;
+        excluded |= (exclude.words_[i] & mask.words_[i]) != 0;
+        hit |= (oneOf.words_[i] & mask.words_[i]) != 0;
+        constrained |= oneOf.words_[i] != 0;
+    }
+    return !missing && !excluded && (hit || !constrained);
+}
+
+/// Tests a contiguous array of masks against one require/exclude/oneOf set, writing whether each passes.
+/// Returns the number that passed. The vector paths test four masks per iteration as independent chains
+/// and load the aspect's words once per word block instead of once per mask.
+inline size_t MasksPass(const ComponentBits* masks, size_t count, const ComponentBits& require, const ComponentBits& exclude, const ComponentBits& oneOf, bool* results)
 {
-    unsigned flatIndex = 0;
-    for (unsigned i = 0; i < referenceBits.size(); ++i)
+    // Results are combined bitwise rather than short-circuited, the outcome is data dependent and would mispredict
+    const int unconstrained = oneOf.none();
+    size_t passed = 0;
+    size_t i = 0;
+#if defined(PARSECS_SIMD_AVX2)
+    if (ComponentBits::WordCount % 4 == 0)
+    {
+        // Missing required and present excluded bits both reject, so they share an accumulator
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256i rejected0 = _mm256_setzero_si256(), rejected1 = rejected0, rejected2 = rejected0, rejected3 = rejected0;
+            __m256i hit0 = rejected0, hit1 = rejected0, hit2 = rejected0, hit3 = rejected0;
+            for (size_t w = 0; w < ComponentBits::WordCount; w += 4)
+            {
+                const __m256i r = _mm256_loadu_si256((const __m256i*)(require.words_ + w));
+                const __m256i e = _mm256_loadu_si256((const __m256i*)(exclude.words_ + w));
+                const __m256i o = _mm256_loadu_si256((const __m256i*)(oneOf.words_ + w));
+                const __m256i m0 = _mm256_loadu_si256((const __m256i*)(masks[i].words_ + w));
+                const __m256i m1 = _mm256_loadu_si256((const __m256i*)(masks[i + 1].words_ + w));
+                const __m256i m2 = _mm256_loadu_si256((const __m256i*)(masks[i + 2].words_ + w));
+                const __m256i m3 = _mm256_loadu_si256((const __m256i*)(masks[i + 3].words_ + w));
+                rejected0 = _mm256_or_si256(rejected0, _mm256_or_si256(_mm256_andnot_si256(m0, r), _mm256_and_si256(m0, e)));
+                rejected1 = _mm256_or_si256(rejected1, _mm256_or_si256(_mm256_andnot_si256(m1, r), _mm256_and_si256(m1, e)));
+                rejected2 = _mm256_or_si256(rejected2, _mm256_or_si256(_mm256_andnot_si256(m2, r), _mm256_and_si256(m2, e)));
+                rejected3 = _mm256_or_si256(rejected3, _mm256_or_si256(_mm256_andnot_si256(m3, r), _mm256_and_si256(m3, e)));
+                hit0 = _mm256_or_si256(hit0, _mm256_and_si256(m0, o));
+                hit1 = _mm256_or_si256(hit1, _mm256_and_si256(m1, o));
+                hit2 = _mm256_or_si256(hit2, _mm256_and_si256(m2, o));
+                hit3 = _mm256_or_si256(hit3, _mm256_and_si256(m3, o));
+            }
+            results[i] = (_mm256_testz_si256(rejected0, rejected0) & (unconstrained | !_mm256_testz_si256(hit0, hit0))) != 0;
+            results[i + 1] = (_mm256_testz_si256(rejected1, rejected1) & (unconstrained | !_mm256_testz_si256(hit1, hit1))) != 0;
+            results[i + 2] = (_mm256_testz_si256(rejected2, rejected2) & (unconstrained | !_mm256_testz_si256(hit2, hit2))) != 0;
+            results[i + 3] = (_mm256_testz_si256(rejected3, rejected3) & (unconstrained | !_mm256_testz_si256(hit3, hit3))) != 0;
+            passed += results[i] + results[i + 1] + results[i + 2] + results[i + 3];
+        }
+    }
+#elif defined(PARSECS_SIMD_SSE2)
+    if (ComponentBits::WordCount % 2 == 0)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i rejected0 = zero, rejected1 = zero, rejected2 = zero, rejected3 = zero;
+            __m128i hit0 = zero, hit1 = zero, hit2 = zero, hit3 = zero;
+            for (size_t w = 0; w < ComponentBits::WordCount; w += 2)
+            {
+                const __m128i r = _mm_loadu_si128((const __m128i*)(require.words_ + w));
+                const __m128i e = _mm_loadu_si128((const __m128i*)(exclude.words_ + w));
+                const __m128i o = _mm_loadu_si128((const __m128i*)(oneOf.words_ + w));
+                const __m128i m0 = _mm_loadu_si128((const __m128i*)(masks[i].words_ + w));
+                const __m128i m1 = _mm_loadu_si128((const __m128i*)(masks[i + 1].words_ + w));
+                const __m128i m2 = _mm_loadu_si128((const __m128i*)(masks[i + 2].words_ + w));
+                const __m128i m3 = _mm_loadu_si128((const __m128i*)(masks[i + 3].words_ + w));
+                rejected0 = _mm_or_si128(rejected0, _mm_or_si128(_mm_andnot_si128(m0, r), _mm_and_si128(m0, e)));
+                rejected1 = _mm_or_si128(rejected1, _mm_or_si128(_mm_andnot_si128(m1, r), _mm_and_si128(m1, e)));
+                rejected2 = _mm_or_si128(rejected2, _mm_or_si128(_mm_andnot_si128(m2, r), _mm_and_si128(m2, e)));
+                rejected3 = _mm_or_si128(rejected3, _mm_or_si128(_mm_andnot_si128(m3, r), _mm_and_si128(m3, e)));
+                hit0 = _mm_or_si128(hit0, _mm_and_si128(m0, o));
+                hit1 = _mm_or_si128(hit1, _mm_and_si128(m1, o));
+                hit2 = _mm_or_si128(hit2, _mm_and_si128(m2, o));
+                hit3 = _mm_or_si128(hit3, _mm_and_si128(m3, o));
+            }
+            // No SSE4.1 ptest, a register is zero when all 16 byte compares against zero succeed
+            results[i] = ((_mm_movemask_epi8(_mm_cmpeq_epi8(rejected0, zero)) == 0xFFFF) & (unconstrained | (_mm_movemask_epi8(_mm_cmpeq_epi8(hit0, zero)) != 0xFFFF))) != 0;
+            results[i + 1] = ((_mm_movemask_epi8(_mm_cmpeq_epi8(rejected1, zero)) == 0xFFFF) & (unconstrained | (_mm_movemask_epi8(_mm_cmpeq_epi8(hit1, zero)) != 0xFFFF))) != 0;
+            results[i + 2] = ((_mm_movemask_epi8(_mm_cmpeq_epi8(rejected2, zero)) == 0xFFFF) & (unconstrained | (_mm_movemask_epi8(_mm_cmpeq_epi8(hit2, zero)) != 0xFFFF))) != 0;
+            results[i + 3] = ((_mm_movemask_epi8(_mm_cmpeq_epi8(rejected3, zero)) == 0xFFFF) & (unconstrained | (_mm_movemask_epi8(_mm_cmpeq_epi8(hit3, zero)) != 0xFFFF))) != 0;
+            passed += results[i] + results[i + 1] + results[i + 2] + results[i + 3];
+        }
+    }
+#endif
+    for (; i < count; ++i)
     {
-        if (referenceBits.test(i) && i != index)
-            ++flatIndex;
-        else if (i == index)
-            return flatIndex;
+        results[i] = MaskPasses(masks[i], require, exclude, oneOf);
+        passed += results[i];
     }
-    return flatIndex;
+    return passed;
+}
+
+/// Position of a component among the set bits of a mask, the number of set bits below the index.
+inline unsigned FlatIndex(const ComponentBits& referenceBits, size_t index)
+{
+    return referenceBits.CountBelow(index);
 }
 
 inline size_t PrefixSum(const size_t* sizes, size_t index, size_t count)
@@ -35,4 +293,3 @@ inline size_t PrefixSum(std::initializer_list<size_t> sizes, size_t index)
         accum += *cur;
     return accum;
 }
-
@@ -14,13 +14,25 @@ struct ComponentBase
 {    
     typedef uint32_t TypeID;
 
+    /// Components are owned and deleted through this base, e.g. by their SparseSet.
+    virtual ~ComponentBase() {}
+
     virtual size_t StateSize() const = 0;
     virtual CompID GetTypeID() const = 0;
+    /// True if the State is trivially copyable. Storage moves states bitwise and drops them without destruction,
+    /// so definitions refuse components for which this is false.
+    virtual bool HasTrivialState() const = 0;
+    /// If true new states are copied from a prototype that was initialized once, instead of calling InitializeState per instance.
+    virtual bool UsesPrototype() const = 0;
 
 protected:
     friend class EntityManager;
+    friend struct EntityDefinition;
+    friend class SparseSet;
     virtual void _InitializeState(void* state) = 0;
+    virtual void _InitializeStates(void* states, size_t count) = 0;
     virtual void _ConvertState(ComponentBase* oldComponent, void* fromState, void* toState) = 0;
+    virtual void _ConvertStates(ComponentBase* oldComponent, void* fromStates, void* toStates, size_t count) = 0;
 };
 
 template<typename STATE>
@@ -34,14 +46,24 @@ struct Component : public ComponentBase
     virtual size_t StateSize() const override { return sizeof(State); }
     /// Duck-typing.
     virtual CompID GetTypeID() const override { return TypeID; }
+    /// Duck-typing.
+    virtual bool HasTrivialState() const override { return std::is_trivially_copyable<STATE>::value; }
+    /// States are prototyped by default, override to return false if InitializeState must run for every instance, e.g. to seed unique values.
+    virtual bool UsesPrototype() const override { return std::is_trivially_copyable<STATE>::value; }
     
     /// Default behaviour is only placement new.
     virtual void InitializeState(STATE* state) { new (state) State; }
+    /// Initializes a contiguous column of states, default behaviour defers to InitializeState.
+    virtual void InitializeStates(STATE* states, size_t count) { for (size_t i = 0; i < count; ++i) InitializeState(states + i); }
     /// Default behaviour is a total wipe.
     virtual void ConvertState(Component* from, STATE* fromState, STATE* toState) { fromState->~State(); new (toState)State; }
+    /// Converts contiguous arrays of states, default behaviour defers to ConvertState.
+    virtual void ConvertStates(Component* from, STATE* fromStates, STATE* toStates, size_t count) { for (size_t i = 0; i < count; ++i) ConvertState(from, fromStates + i, toStates + i); }
 
 private:
     virtual void _InitializeState(void* state) { InitializeState((STATE*)state); }
+    virtual void _InitializeStates(void* states, size_t count) { InitializeStates((STATE*)states, count); }
     virtual void _ConvertState(ComponentBase* fromComp, void* fromState, void* toState) override { ConvertState((Component*)fromComp, (STATE*)fromState, (STATE*)toState); }
+    virtual void _ConvertStates(ComponentBase* fromComp, void* fromStates, void* toStates, size_t count) override { ConvertStates((Component*)fromComp, (STATE*)fromStates, (STATE*)toStates, count); }
 };
 
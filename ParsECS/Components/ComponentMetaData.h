@@ -17,6 +17,27 @@
 #define END_PROPERTIES() }
 #define END_METADATA() }
 
+/// How a component's state is carried across a promotion to another definition that also has the component.
+enum StateConversion
+{
+    /// The state is re-initialized, the behaviour of the default Component::ConvertState.
+    SC_Reset,
+    /// The state is copied bitwise, only valid for trivially copyable states.
+    SC_Keep,
+    /// The component overrides ConvertState.
+    SC_Custom,
+};
+
+/// Where the states of a component live.
+enum StoragePolicy
+{
+    /// Inline in the chunks of every definition that has the component.
+    SP_Archetype,
+    /// In a per-type SparseSet keyed by entity, added and removed at runtime without changing the entity's definition.
+    /// The set relocates states bitwise and never destructs them, so the State must be trivially copyable.
+    SP_Sparse,
+};
+
 struct ComponentMetaData
 {
     ComponentMetaData(const char* compName, const char* stateName) :
@@ -41,6 +62,16 @@ struct ComponentMetaData
     /// The component is allowed as long as at least one of these components is present.
     ComponentBits anyBits_;
 
+    /// Conversion applied during promotion, detected at registration and may be changed to SC_Keep afterwards.
+    StateConversion conversion_ = SC_Custom;
+
+    /// Sparse components suit transient flags such as "Stunned" or "Selected" that would otherwise multiply definitions.
+    StoragePolicy storage_ = SP_Archetype;
+
+    /// Alignment of the component's columns when it is above alignof(State), e.g. 32 so hot states can be read with aligned AVX loads.
+    /// A power of two up to PARSECS_MAX_STATE_ALIGNMENT, must be set before definitions with the component are sealed.
+    uint32_t columnAlignment_ = 0;
+
     /// Registered list of reflected properties for the Shared Component.
     std::vector<ECSProperty*> componentProperties_;
     /// Registered list of reflected properties for the component state.
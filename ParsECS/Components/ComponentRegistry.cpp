@@ -4,6 +4,8 @@
 
 std::vector<uint32_t> ComponentRegistry::dataSize_(PARSECS_COMPONENT_COUNT);
 
+std::vector<uint32_t> ComponentRegistry::dataAlignment_(PARSECS_COMPONENT_COUNT, 1);
+
 std::vector<std::string> ComponentRegistry::typeNames_(PARSECS_COMPONENT_COUNT);
 
 std::vector< ECSVector<ComponentBase*>* > ComponentRegistry::components_(PARSECS_COMPONENT_COUNT, 0);
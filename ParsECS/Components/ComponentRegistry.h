@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../AlignedAllocator.h"
 #include "../ComponentCount.h"
 
 #include "Component.h"
@@ -21,19 +22,32 @@ class ComponentRegistry
 {
 public:
     static inline size_t GetDataSize(uint32_t bitIndex) { return dataSize_[bitIndex]; }
+    /// Alignment of the component's states, the larger of alignof(State) and the metadata's columnAlignment_.
+    static inline size_t GetDataAlignment(uint32_t bitIndex)
+    {
+        const size_t column = metaData_[bitIndex] ? metaData_[bitIndex]->columnAlignment_ : 0;
+        return std::max<size_t>(dataAlignment_[bitIndex], column);
+    }
 
     static inline std::vector< ComponentMetaData* >& GetMetaData() { return metaData_; }
 
     static ComponentMetaData* GetMetaData(ComponentBase::TypeID componentID);
+    /// Returns true if the component's metadata opts into SP_Sparse storage.
+    static inline bool IsSparse(CompID typeID) { return typeID < metaData_.size() && metaData_[typeID] && metaData_[typeID]->storage_ == SP_Sparse; }
 
     template<typename COMPONENT, typename STATE>
     static void Register(const char* componentName, const char* stateName)
     {
+        static_assert(alignof(STATE) <= PARSECS_MAX_STATE_ALIGNMENT, "State alignment exceeds PARSECS_MAX_STATE_ALIGNMENT");
+        static_assert(std::is_trivially_copyable<STATE>::value, "States are relocated bitwise and never destructed, they must be trivially copyable");
         dataSize_[COMPONENT::TypeID] = sizeof(STATE);
+        dataAlignment_[COMPONENT::TypeID] = (uint32_t)alignof(STATE);
         typeNames_[COMPONENT::TypeID] = componentName;
         typeNameHashToIndexTable_[StringHash(componentName)] = COMPONENT::TypeID;
         //components_[COMPONENT::TypeID] = new ECSVector<ComponentBase*>(new SimpleECSVectorAlloc<COMPONENT*>());
         metaData_[COMPONENT::TypeID] = new ComponentMetaData(componentName, stateName);
+        // If ConvertState isn't overridden the pointer-to-member still names the base Component
+        metaData_[COMPONENT::TypeID]->conversion_ = std::is_same<decltype(&COMPONENT::ConvertState), decltype(&Component<STATE>::ConvertState)>::value ? SC_Reset : SC_Custom;
     }
 
     static ComponentBase::TypeID GetIndexFromTypeName(const char* name);
@@ -45,6 +59,8 @@ private:
     static std::unordered_map<StringHash, ComponentBase::TypeID> typeNameHashToIndexTable_;
     /// Stores the sizeof(ComponentState) for all component states.
     static std::vector<size_t> dataSize_;
+    /// Stores the alignof(ComponentState) for all component states.
+    static std::vector<uint32_t> dataAlignment_;
     /// @Deprecated: list of components. Moved to local storage in the EntityDefinition.
     static std::vector< ECSVector<ComponentBase*>* > components_;
     /// Contains the property tables for each component type.
@@ -1,31 +1,178 @@
 #include "ConcernedList.h"
 
 #include "ComponentCount.h"
+#include "Entities/EntityDatabase.h"
+#include "Entities/EntityDefinition.h"
+#include "Entities/EntityStorage.h"
+#include "../SysHub/JobSystem.h"
 
 #include <algorithm>
+#include <cassert>
 
 ConcernedList::ConcernedList(const Aspect& aspect) :
     aspect_(aspect)
 {
 }
 
+/// Orders by the location of the entity states within their storage.
+static inline bool StorageOrder(const ConcernedEntity& lhs, const ConcernedEntity& rhs)
+{
+    if (lhs.entity_->chunk_ != rhs.entity_->chunk_)
+        return lhs.entity_->chunk_ < rhs.entity_->chunk_;
+    return lhs.entity_->chunkIndex_ < rhs.entity_->chunkIndex_;
+}
+
 void ConcernedList::SortList()
 {
     if (size() > sortingMin_ && size() < sortingMax_)
     {
         if (sortDefinition_)
             std::sort(begin(), end(), [](const ConcernedEntity& lhs, const ConcernedEntity& rhs) {
-            if (lhs.defID_ < rhs.defID_)
-                return true;
-            return lhs.dataAddr_ < rhs.dataAddr_;
+            if (lhs.defID_ != rhs.defID_)
+                return lhs.defID_ < rhs.defID_;
+            return StorageOrder(lhs, rhs);
         });
         else
-            std::sort(begin(), end(), [](const ConcernedEntity& lhs, const ConcernedEntity& rhs) {
-            return lhs.dataAddr_ < rhs.dataAddr_;
-        });
+            std::sort(begin(), end(), StorageOrder);
+        ++modificationCount_;
     }
 }
 
+void ConcernedList::AddUpdateLevel(float minImportance, uint32_t interval)
+{
+    assert(interval > 0 && interval <= USHRT_MAX);
+    assert(levels_.empty() || levels_.back().minImportance_ > minImportance);
+    levels_.push_back({ minImportance, interval ? interval : 1, 0, 0 });
+
+    // The first level gives the entities already in the list their initial buckets
+    if (levels_.size() == 1)
+        AssignNewBuckets(0);
+}
+
+void ConcernedList::SetImportance(size_t index, float importance)
+{
+    if (levels_.empty())
+        return;
+
+    uint16_t level = 0;
+    while (level + 1u < levels_.size() && importance < levels_[level].minImportance_)
+        ++level;
+
+    ConcernedEntity& rec = (*this)[index];
+    if (rec.updateLevel_ != level)
+        AssignBucket(rec, level);
+}
+
+void ConcernedList::BeginFrame(uint64_t frame)
+{
+    for (auto& level : levels_)
+        level.duePhase_ = (uint32_t)(frame % level.interval_);
+}
+
+void ConcernedList::AssignBucket(ConcernedEntity& rec, uint16_t level)
+{
+    UpdateLevel& target = levels_[level];
+    rec.updateLevel_ = level;
+    rec.updatePhase_ = (uint16_t)target.nextPhase_;
+    target.nextPhase_ = (target.nextPhase_ + 1) % target.interval_;
+}
+
+void ConcernedList::AssignNewBuckets(size_t from)
+{
+    if (levels_.empty())
+        return;
+    for (size_t i = from; i < size(); ++i)
+        AssignBucket((*this)[i], 0);
+}
+
+void ConcernedList::GetRanges(std::vector<ConcernedRange>& ranges, size_t maxRangeSize) const
+{
+    if (!maxRangeSize)
+        maxRangeSize = size();
+
+    size_t begin = 0;
+    while (begin < size())
+    {
+        const DefID defID = (*this)[begin].defID_;
+        size_t end = begin + 1;
+        while (end < size() && end - begin < maxRangeSize && (*this)[end].defID_ == defID)
+            ++end;
+        ranges.push_back({ defID, begin, end });
+        begin = end;
+    }
+}
+
+void ConcernedList::ParallelForEach(JobSystem* jobs, std::function<void(const ConcernedEntity*, size_t, size_t)> kernel, size_t maxRangeSize) const
+{
+    std::vector<ConcernedRange> ranges;
+    GetRanges(ranges, maxRangeSize);
+
+    if (!jobs)
+    {
+        for (size_t i = 0; i < ranges.size(); ++i)
+            kernel(data() + ranges[i].begin_, ranges[i].end_ - ranges[i].begin_, i);
+        return;
+    }
+
+    jobs->ParallelFor(0, ranges.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            kernel(data() + ranges[i].begin_, ranges[i].end_ - ranges[i].begin_, i);
+    });
+}
+
+void ConcernedList::Connect(EntityManager* manager)
+{
+    EntityObserver::Connect(manager);
+    if (!manager)
+        return;
+
+    std::vector<EntityDefinition*> definitions;
+    EntityDatabase::GetInstance()->GetMatchingDefinitions(aspect_, definitions);
+    for (auto definition : definitions)
+    {
+        auto& storages = manager->GetStorages();
+        if (definition->id_ >= storages.size() || !storages[definition->id_])
+            continue;
+
+        EntityStorage* storage = storages[definition->id_];
+        const size_t start = size();
+        reserve(size() + storage->GetEntityCount());
+        for (size_t c = 0; c < storage->GetChunkCount(); ++c)
+        {
+            StorageChunk* chunk = storage->GetChunk(c);
+            const EntityID* ids = chunk->GetIDs();
+            for (uint32_t i = 0; i < chunk->count_; ++i)
+                push_back({ ids[i], definition->id_, manager->GetEntity(ids[i]) });
+        }
+        AssignNewBuckets(start);
+    }
+}
+
+bool ConcernedList::Concerns(DefID definition)
+{
+    EntityDatabase* database = EntityDatabase::GetInstance();
+    if (matchingVersion_ != database->GetVersion())
+    {
+        std::vector<EntityDefinition*> matched;
+        matchingVersion_ = database->GetMatchingDefinitions(aspect_, matched);
+        matchingDefinitions_.clear();
+        for (auto definition : matched)
+        {
+            if (definition->id_ >= matchingDefinitions_.size())
+                matchingDefinitions_.resize(definition->id_ + 1, false);
+            matchingDefinitions_[definition->id_] = true;
+        }
+    }
+    return definition < matchingDefinitions_.size() && matchingDefinitions_[definition];
+}
+
+bool ConcernedList::Concerns(const Entity* entity)
+{
+    if (!entity->definition_)
+        return aspect_.Passes(entity->mask_);
+    return Concerns(entity->defId_);
+}
+
 void ConcernedList::AddSystem(EntitySystem* system)
 {
     using_.push_back(system);
@@ -38,26 +185,90 @@ void ConcernedList::RemoveSystem(EntitySystem* system)
         using_.erase(found);
 }
 
-void ConcernedList::EntityAdded(Entity* entity)
+void ConcernedList::EntitiesAdded(DefID definition, const EntityID* ids, size_t count)
 {
-    if (entity && aspect_.Passes(entity->mask_))
-        push_back({ entity->id_, entity->defId_, entity->components_ });
+    if (definition == (DefID)-1)
+    {
+        const size_t start = size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            Entity* entity = manager_->GetEntity(ids[i]);
+            if (entity && Concerns(entity))
+                push_back({ ids[i], definition, entity });
+        }
+        AssignNewBuckets(start);
+        return;
+    }
+
+    if (!Concerns(definition))
+        return;
+
+    // The whole span is taken at once, one test per definition instead of per entity
+    const size_t start = size();
+    resize(start + count);
+    ConcernedEntity* records = data() + start;
+    for (size_t i = 0; i < count; ++i)
+        records[i] = { ids[i], definition, manager_->GetEntity(ids[i]) };
+    AssignNewBuckets(start);
 }
 
-void ConcernedList::EntityRemoved(Entity* entity)
+void ConcernedList::EntitiesRemoved(DefID definition, const EntityID* ids, size_t count)
 {
-    if (entity && aspect_.Passes(entity->mask_))
+    if (definition != (DefID)-1 && !Concerns(definition))
+        return;
+
+    if (count == 1)
     {
-        //auto found = std::find(using_.begin(), using_.end(), ConcernedEntity { entity->id_, entity->defId_, entity->components_ });
-        //if (found != using_.end())
-        //{
-        //    std::swap(*found, using_.back());
-        //    using_.pop_back();
-        //}
+        auto found = std::find_if(begin(), end(), [=](const ConcernedEntity& rec) { return rec.entityID_ == ids[0]; });
+        if (found != end())
+        {
+            *found = back();
+            pop_back();
+            ++modificationCount_;
+        }
+        return;
     }
+
+    // One pass over the list instead of a search per entity
+    std::vector<EntityID> removed(ids, ids + count);
+    std::sort(removed.begin(), removed.end());
+    auto newEnd = std::remove_if(begin(), end(), [&](const ConcernedEntity& rec) { return std::binary_search(removed.begin(), removed.end(), rec.entityID_); });
+    if (newEnd != end())
+        ++modificationCount_;
+    erase(newEnd, end());
 }
 
-void ConcernedList::EntityPromoted(Entity* entity)
+void ConcernedList::EntitiesPromoted(DefID definition, const EntityID* ids, size_t count)
 {
+    const bool passes = Concerns(definition);
 
+    std::vector<EntityID> promoted(ids, ids + count);
+    std::sort(promoted.begin(), promoted.end());
+    if (!passes)
+    {
+        auto newEnd = std::remove_if(begin(), end(), [&](const ConcernedEntity& rec) { return std::binary_search(promoted.begin(), promoted.end(), rec.entityID_); });
+        if (newEnd != end())
+            ++modificationCount_;
+        erase(newEnd, end());
+        return;
+    }
+
+    // Entities already listed are retagged in place, the ones not found are appended afterwards
+    std::vector<bool> listed(count, false);
+    for (ConcernedEntity& rec : *this)
+    {
+        auto found = std::lower_bound(promoted.begin(), promoted.end(), rec.entityID_);
+        if (found == promoted.end() || *found != rec.entityID_)
+            continue;
+        listed[found - promoted.begin()] = true;
+        rec.defID_ = definition;
+    }
+
+    const size_t start = size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!listed[i])
+            push_back({ promoted[i], definition, manager_->GetEntity(promoted[i]) });
+    }
+    AssignNewBuckets(start);
 }
\ No newline at end of file
@@ -5,9 +5,19 @@
 #include "Entities/EntityManager.h"
 #include "Entities/EntityObserver.h"
 
+#include <climits>
 #include <vector>
 
 class EntitySystem;
+class JobSystem;
+
+/// Run [begin_, end_) of a ConcernedList whose entities share a definition.
+struct ConcernedRange
+{
+    DefID defID_;
+    size_t begin_;
+    size_t end_;
+};
 
 /// Concerned lists track collections of entities that others are interested in observing.
 class ConcernedList : public std::vector <ConcernedEntity>, public EntityObserver
@@ -21,18 +31,84 @@ public:
     void SetSortingDefinitions(bool state) { sortDefinition_ = state; }
 
     void SortList();
+    /// Incremented whenever entries are removed or reordered. Appends leave it unchanged, they don't move
+    /// existing entries, so a position taken while it is unchanged still refers to the same entity.
+    uint32_t GetModificationCount() const { return modificationCount_; }
+
+    /// Splits the list into ranges of at most maxRangeSize entities that share a definition.
+    /// Ranges are longest after SortList, which groups definitions and orders them by storage location.
+    void GetRanges(std::vector<ConcernedRange>& ranges, size_t maxRangeSize = 256) const;
+    /// Runs kernel(entities, count, rangeIndex) for each range on the job system's threads, returns when all are done.
+    /// Without a job system the ranges run in order on the calling thread. The list must not change while running.
+    void ParallelForEach(JobSystem* jobs, std::function<void(const ConcernedEntity*, size_t, size_t)> kernel, size_t maxRangeSize = 256) const;
+
+// Update frequency buckets, less important entities are spread round-robin over the frames of their level's interval
+    /// Adds an update level for entities whose importance is at least minImportance, they are due once every interval frames.
+    /// Levels are added from most to least important, entities below the last level use it. Without levels every entity is due every frame.
+    void AddUpdateLevel(float minImportance, uint32_t interval);
+    size_t GetUpdateLevelCount() const { return levels_.size(); }
+    /// Sets the importance of the entity at a position in the list. The entity keeps its bucket unless it moves to another level.
+    void SetImportance(size_t index, float importance);
+    /// Selects the buckets due on a frame.
+    void BeginFrame(uint64_t frame);
+    /// Returns true if the entity at a position is due this frame.
+    bool IsDue(size_t index) const
+    {
+        const ConcernedEntity& rec = (*this)[index];
+        return levels_.empty() || levels_[rec.updateLevel_].duePhase_ == rec.updatePhase_;
+    }
+    /// Invokes function(const ConcernedEntity&) for each entity due this frame.
+    template<typename FN>
+    void EachDue(FN&& function) const
+    {
+        for (size_t i = 0; i < size(); ++i)
+            if (IsDue(i))
+                function((*this)[i]);
+    }
+
+    /// Starts observing the manager and picks up the existing entities of matching definitions.
+    virtual void Connect(EntityManager* manager) override;
 
     virtual void AddSystem(EntitySystem* system);
     virtual void RemoveSystem(EntitySystem* system);
 
-    virtual void EntityAdded(Entity*) override;
-    virtual void EntityRemoved(Entity*) override;
-    virtual void EntityPromoted(Entity*) override;
+    /// Appends the whole span if the definition passes the aspect.
+    virtual void EntitiesAdded(DefID definition, const EntityID* ids, size_t count) override;
+    virtual void EntitiesRemoved(DefID definition, const EntityID* ids, size_t count) override;
+    /// Retags, drops or appends the entities depending on whether their new definition passes.
+    virtual void EntitiesPromoted(DefID definition, const EntityID* ids, size_t count) override;
 
     const std::vector<ConcernedEntity>& GetEntities() const { return *this; }
 
 private:
+    /// Returns true if the definition passes the aspect.
+    bool Concerns(DefID definition);
+    /// Returns true if the entity's definition passes the aspect, entities without a definition are tested by mask.
+    bool Concerns(const Entity* entity);
+
+    /// Puts an entity into the next bucket of a level.
+    void AssignBucket(ConcernedEntity& rec, uint16_t level);
+    /// Assigns buckets to the records appended from a position on, new entities start in the most important level.
+    void AssignNewBuckets(size_t from);
+
+    /// Update level, see AddUpdateLevel.
+    struct UpdateLevel
+    {
+        float minImportance_;
+        uint32_t interval_;
+        /// Phase handed to the next entity entering the level.
+        uint32_t nextPhase_;
+        /// Phase due on the current frame.
+        uint32_t duePhase_;
+    };
+
     Aspect aspect_;
+    /// Update levels from most to least important.
+    std::vector<UpdateLevel> levels_;
+    /// Whether each DefID passes the aspect, built from the EntityDatabase's cached matches.
+    std::vector<bool> matchingDefinitions_;
+    /// EntityDatabase version that matchingDefinitions_ was built from.
+    uint32_t matchingVersion_ = -1;
     /// Concerned list must be larger than this before we'll sort
     size_t sortingMin_ = 32;
     /// Concert list must be smaller than this for us to sort
@@ -41,4 +117,6 @@ private:
     bool sortDefinition_ = true;
     /// List of EntitySystems that reference this list
     std::vector<EntitySystem*> using_;
+    /// See GetModificationCount.
+    uint32_t modificationCount_ = 0;
 };
\ No newline at end of file
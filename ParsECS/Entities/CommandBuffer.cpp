@@ -0,0 +1,51 @@
+#include "CommandBuffer.h"
+
+#include <cstring>
+
+void CommandBuffer::CreateEntity(EntityDefinition* definition, CreateFunction initializer)
+{
+    assert(definition);
+    commands_.push_back({ CMD_Create, (EntityID)-1, definition, 0, (uint32_t)initializers_.size(), 0 });
+    initializers_.push_back(initializer);
+}
+
+void CommandBuffer::DestroyEntity(EntityID entity)
+{
+    commands_.push_back({ CMD_Destroy, entity, 0x0, 0, 0, 0 });
+}
+
+void CommandBuffer::PromoteEntity(EntityID entity, EntityDefinition* toDefinition)
+{
+    assert(toDefinition);
+    commands_.push_back({ CMD_Promote, entity, toDefinition, 0, 0, 0 });
+}
+
+void CommandBuffer::AddSparseState(EntityID entity, CompID typeID, const void* state, size_t stateSize)
+{
+    const uint32_t offset = (uint32_t)data_.size();
+    if (state && stateSize)
+    {
+        data_.resize(data_.size() + stateSize);
+        memcpy(data_.data() + offset, state, stateSize);
+    }
+    commands_.push_back({ CMD_AddSparse, entity, 0x0, typeID, offset, state ? (uint32_t)stateSize : 0 });
+}
+
+void CommandBuffer::RemoveSparseState(EntityID entity, CompID typeID)
+{
+    commands_.push_back({ CMD_RemoveSparse, entity, 0x0, typeID, 0, 0 });
+}
+
+void CommandBuffer::Swap(CommandBuffer& other)
+{
+    commands_.swap(other.commands_);
+    data_.swap(other.data_);
+    initializers_.swap(other.initializers_);
+}
+
+void CommandBuffer::Clear()
+{
+    commands_.clear();
+    data_.clear();
+    initializers_.clear();
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../ParsecDef.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct Entity;
+struct EntityDefinition;
+
+/// Records structural changes made while systems run so that they can be applied together at a sync point.
+/// Each thread records into its own buffer, see EntityManager::GetCommandBuffer(), EntityManager::ResolvePending() applies them.
+class CommandBuffer
+{
+public:
+    /// Invoked on a deferred entity once it has been created and its states initialized.
+    typedef std::function<void(Entity*)> CreateFunction;
+
+    /// Queue the creation of an entity, initializer may be empty.
+    void CreateEntity(EntityDefinition* definition, CreateFunction initializer = CreateFunction());
+    /// Queue the destruction of an entity.
+    void DestroyEntity(EntityID entity);
+    /// Queue moving an entity to another definition.
+    void PromoteEntity(EntityID entity, EntityDefinition* toDefinition);
+    /// Queue adding a sparse component, the state bytes are copied over the initialized state if given.
+    void AddSparseState(EntityID entity, CompID typeID, const void* state = 0x0, size_t stateSize = 0);
+    /// Queue removing a sparse component.
+    void RemoveSparseState(EntityID entity, CompID typeID);
+
+    template<typename T>
+    void AddSparseState(EntityID entity, const typename T::State& state) { AddSparseState(entity, T::TypeID, &state, sizeof(state)); }
+    template<typename T>
+    void RemoveSparseState(EntityID entity) { RemoveSparseState(entity, T::TypeID); }
+
+    /// Number of recorded commands.
+    size_t GetCount() const { return commands_.size(); }
+    bool IsEmpty() const { return commands_.empty(); }
+    /// Discards all recorded commands.
+    void Clear();
+    /// Exchanges the recorded commands with another buffer.
+    void Swap(CommandBuffer& other);
+
+private:
+    friend class EntityManager;
+
+    enum CommandType
+    {
+        CMD_Create,
+        CMD_Destroy,
+        CMD_Promote,
+        CMD_AddSparse,
+        CMD_RemoveSparse,
+    };
+
+    struct Command
+    {
+        CommandType type_;
+        EntityID entity_;
+        /// Definition to create or promote into.
+        EntityDefinition* definition_;
+        /// Sparse component type.
+        CompID typeID_;
+        /// Offset of the state payload in data_, or of the initializer in initializers_ for creation.
+        uint32_t payload_;
+        /// Size of the state payload, 0 if none.
+        uint32_t payloadSize_;
+    };
+
+    std::vector<Command> commands_;
+    /// State payloads of sparse additions.
+    std::vector<unsigned char> data_;
+    /// Initializers of creations.
+    std::vector<CreateFunction> initializers_;
+};
\ No newline at end of file
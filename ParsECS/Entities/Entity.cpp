@@ -3,15 +3,12 @@
 #include "../Components/Component.h"
 #include "../Components/ComponentRegistry.h"
 #include "EntityDefinition.h"
+#include "EntityStorage.h"
 
 ComponentState* Entity::GetComponentState(CompID index)
 {
-    size_t offset = 0;
-    for (unsigned i = 0; i < mask_.size(); ++i)
-        if (mask_[i] && i != index)
-            offset += ComponentRegistry::GetDataSize(i);
-        else if (i == index)
-            return (ComponentState*)((char*)components_ + offset);
+    if (chunk_ && mask_.test(index))
+        return (ComponentState*)((unsigned char*)chunk_ + definition_->layout_.columnOffset_[index] + ComponentRegistry::GetDataSize(index) * chunkIndex_);
     return 0x0;
 }
 
@@ -25,16 +22,14 @@ ComponentState* Entity::GetComponentState(const char* typeName)
 
 ComponentBase* Entity::GetComponent(CompID bitIndex)
 {
-    EntityDefinition* def = 0x0;
-    if (def)
-        return def->GetComponent(bitIndex);
+    if (definition_)
+        return definition_->GetComponent(bitIndex);
     return 0x0;
 }
 
 ComponentBase* Entity::GetComponent(const char* typeName)
 {
-    EntityDefinition* def = 0x0;
-    if (def)
-        return def->GetComponent(typeName);
+    if (definition_)
+        return definition_->GetComponent(typeName);
     return 0x0;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "../ParsecDef.h"
 #include "../ComponentCount.h"
+#include "EntityDefinition.h"
 
 #include <stdint.h>
 #include <bitset>
@@ -15,13 +16,24 @@ struct Entity
     EntityID id_ = -1;
     DefID defId_ = -1;
     ComponentBits mask_;
-    ComponentState* components_ = 0x0;
+    EntityDefinition* definition_ = 0x0;
+    /// Chunk of the definition's EntityStorage holding the component states, 0x0 until the entity is filled.
+    StorageChunk* chunk_ = 0x0;
+    /// Position of the entity within the chunk's columns.
+    uint32_t chunkIndex_ = 0;
+    /// Sparse components the entity has, their states live in the EntityManager's SparseSets.
+    ComponentBits sparseMask_;
 
     ComponentState* GetComponentState(CompID index);
     ComponentState* GetComponentState(const char* typeName);
 
+    /// Typed state access using the definition's precomputed column offsets, the entity must have the component.
     template<typename T>
-    T* GetComponentState() { return (T*)GetComponent(index); }
+    typename T::State* GetComponentState()
+    {
+        assert(chunk_ && mask_.test(T::TypeID));
+        return (typename T::State*)((unsigned char*)chunk_ + definition_->layout_.columnOffset_[T::TypeID]) + chunkIndex_;
+    }
 
     ComponentBase* GetComponent(CompID bitIndex);
     ComponentBase* GetComponent(const char* typeName);
@@ -33,10 +45,15 @@ struct Entity
 };
 
 /// Used for things that need to store references to entities.
-/// The defID and dataAddress allow systems/observers to sort their lists based on different needs
+/// The defID and entity record allow systems/observers to sort their lists based on different needs,
+/// the entity record is used instead of a data address as states move within their EntityStorage.
 struct ConcernedEntity
 {
     EntityID entityID_;
     DefID defID_;
-    ComponentState* dataAddr_;
+    Entity* entity_;
+    /// Update level in the owning ConcernedList, 0 is the most important.
+    uint16_t updateLevel_;
+    /// Frame of the level's interval at which the entity is due.
+    uint16_t updatePhase_;
 };
\ No newline at end of file
@@ -3,27 +3,111 @@
 #include "Entity.h"
 #include "EntityDefinition.h"
 
+#include <algorithm>
+#include <mutex>
+
 EntityDefinition* EntityDatabase::GetEntityDefinition(DefID id)
 {
+    std::shared_lock<std::shared_mutex> lock(lock_);
     auto found = entityTable_.find(id);
     if (found != entityTable_.end())
         return found->second;
     return 0x0;
 }
 
+void EntityDatabase::RegisterDefinition(EntityDefinition* definition)
+{
+    assert(definition);
+
+    std::unique_lock<std::shared_mutex> lock(lock_);
+    auto& slot = entityTable_[definition->id_];
+    if (slot == definition)
+        return;
+
+    // A definition replacing another under the same ID takes over its place
+    if (slot)
+    {
+        std::replace(entityTypes_.begin(), entityTypes_.end(), slot, definition);
+        for (auto& match : aspectMatches_)
+            match.second.erase(std::remove(match.second.begin(), match.second.end(), slot), match.second.end());
+    }
+    else
+        entityTypes_.push_back(definition);
+    slot = definition;
+
+    for (auto& match : aspectMatches_)
+        if (match.first.Passes(definition->mask_))
+            match.second.push_back(definition);
+    ++version_;
+}
+
+void EntityDatabase::DefinitionChanged(EntityDefinition* definition)
+{
+    std::unique_lock<std::shared_mutex> lock(lock_);
+    auto registered = entityTable_.find(definition->id_);
+    if (registered == entityTable_.end() || registered->second != definition)
+        return;
+
+    for (auto& match : aspectMatches_)
+    {
+        auto& list = match.second;
+        auto found = std::find(list.begin(), list.end(), definition);
+        const bool passes = match.first.Passes(definition->mask_);
+        if (found != list.end() && !passes)
+            list.erase(found);
+        else if (found == list.end() && passes)
+            list.push_back(definition);
+    }
+    ++version_;
+}
+
+bool EntityDatabase::IsRegistered(const EntityDefinition* definition) const
+{
+    std::shared_lock<std::shared_mutex> lock(lock_);
+    auto found = entityTable_.find(definition->id_);
+    return found != entityTable_.end() && found->second == definition;
+}
+
+uint32_t EntityDatabase::GetMatchingDefinitions(const Aspect& aspect, std::vector<EntityDefinition*>& holder)
+{
+    // The list is copied under the lock, a registration may change the cached one as soon as it is released
+    {
+        std::shared_lock<std::shared_mutex> lock(lock_);
+        auto found = aspectMatches_.find(aspect);
+        if (found != aspectMatches_.end())
+        {
+            holder.insert(holder.end(), found->second.begin(), found->second.end());
+            return version_;
+        }
+    }
+
+    // Another thread may have filled the entry between the two locks, emplace keeps its list
+    std::unique_lock<std::shared_mutex> lock(lock_);
+    auto inserted = aspectMatches_.emplace(aspect, std::vector<EntityDefinition*>());
+    if (inserted.second)
+        aspect.Select(entityTypes_.data(), entityTypes_.size(), inserted.first->second);
+    holder.insert(holder.end(), inserted.first->second.begin(), inserted.first->second.end());
+    return version_;
+}
+
+uint32_t EntityDatabase::GetVersion() const
+{
+    std::shared_lock<std::shared_mutex> lock(lock_);
+    return version_;
+}
+
 void EntityDatabase::GetEntityDefinitions(const ComponentBits& mask, std::vector<EntityDefinition*>& holder) const
 {
-    const size_t count = mask.count();
+    std::shared_lock<std::shared_mutex> lock(lock_);
     for (auto record : entityTypes_)
-        if ((mask & record->mask_).count() == count)
+        if (record->mask_.Contains(mask))
             holder.push_back(record);
 }
 
 void EntityDatabase::GetEntityDefinitions(const Aspect& aspect, std::vector<EntityDefinition*>& holder) const
 {
-    for (auto record : entityTypes_)
-        if (aspect.Passes(record->mask_))
-            holder.push_back(record);
+    std::shared_lock<std::shared_mutex> lock(lock_);
+    aspect.Select(entityTypes_.data(), entityTypes_.size(), holder);
 }
 
 ComponentBase* EntityDatabase::GetComponent(CompID typeID, DefID entityID)
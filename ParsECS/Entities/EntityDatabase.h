@@ -7,6 +7,7 @@
 #include "../Singleton.h"
 
 #include <cstdint>
+#include <shared_mutex>
 #include <unordered_map>
 
 struct EntityDefinition;
@@ -20,6 +21,18 @@ public:
     /// Get an entity definition by id.
     EntityDefinition* GetEntityDefinition(DefID id);
 
+    /// Registers a definition so that it can be found by ID and by aspect, replaces any definition with the same ID.
+    void RegisterDefinition(EntityDefinition* definition);
+    /// Re-evaluates the cached aspect matches of a registered definition whose mask has changed.
+    void DefinitionChanged(EntityDefinition* definition);
+    /// Returns true if the definition is the one registered under its ID.
+    bool IsRegistered(const EntityDefinition* definition) const;
+    /// Appends the definitions for which an aspect passes, cached per aspect and updated as definitions are registered or changed.
+    /// Safe to call from systems running in parallel. Returns the version the copy was taken at.
+    uint32_t GetMatchingDefinitions(const Aspect& aspect, std::vector<EntityDefinition*>& holder);
+    /// Incremented whenever a definition is registered or changed, anything derived from the matches is stale when this differs.
+    uint32_t GetVersion() const;
+
     /// Query for entities that exactly match the given mask.
     void GetEntityDefinitions(const ComponentBits& mask, std::vector<EntityDefinition*>& holder) const;
     /// Query for entities for which an aspect passes.
@@ -43,4 +56,10 @@ private:
     std::unordered_map<uint32_t, EntityDefinition*> entityTable_;
     std::vector<EntityDefinition*> entityTypes_;
     std::vector< ECSVector<ComponentBase*>* > components_;
+    /// Matching definitions of every aspect that has been queried.
+    std::unordered_map<Aspect, std::vector<EntityDefinition*>, AspectHash> aspectMatches_;
+    /// Guards the tables and aspectMatches_, lookups share it, registrations and the first query of an aspect take it exclusively.
+    mutable std::shared_mutex lock_;
+    /// Bumped on every registration or change.
+    uint32_t version_ = 0;
 };
\ No newline at end of file
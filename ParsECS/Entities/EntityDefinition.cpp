@@ -1,12 +1,16 @@
 #include "EntityDefinition.h"
 
 #include "Entity.h"
+#include "EntityDatabase.h"
 #include "../Components/Component.h"
 #include "../Components/ComponentRegistry.h"
 
+#include <algorithm>
+#include <cstring>
+
 EntityDefinition::EntityDefinition()
 {
-
+    name_[0] = 0;
 }
 
 EntityDefinition::~EntityDefinition()
@@ -16,8 +20,81 @@ EntityDefinition::~EntityDefinition()
     components_.clear();
 }
 
+void EntityDefinition::Seal()
+{
+    if (flags_ & EDF_Sealed)
+        return;
+
+    // Chunks move states with memcpy when entities are freed, swapped or compacted and never run destructors
+    for (auto component : components_)
+        assert(component->HasTrivialState() && "Component states must be trivially copyable");
+
+    stateSize_ = 0;
+    for (unsigned i = 0; i < mask_.size(); ++i)
+    {
+        if (mask_[i])
+        {
+            assert(!ComponentRegistry::IsSparse(i) && "Sparse components are added to entities, not definitions");
+            stateSize_ += (uint32_t)ComponentRegistry::GetDataSize(i);
+        }
+    }
+
+    layout_.Build(mask_);
+
+    // Initialize one instance of each prototyped state, new entities are then a copy away
+    prototype_.clear();
+    prototypeOffsets_.assign(components_.size(), (uint32_t)-1);
+    for (size_t i = 0; i < components_.size(); ++i)
+    {
+        if (components_[i]->UsesPrototype())
+        {
+            prototypeOffsets_[i] = (uint32_t)prototype_.size();
+            prototype_.resize(AlignUp(prototype_.size() + components_[i]->StateSize(), PARSECS_MAX_STATE_ALIGNMENT));
+        }
+    }
+    for (size_t i = 0; i < components_.size(); ++i)
+        if (prototypeOffsets_[i] != (uint32_t)-1)
+            components_[i]->_InitializeState(prototype_.data() + prototypeOffsets_[i]);
+
+    flags_ |= EDF_Sealed;
+}
+
+void EntityDefinition::InitializeStates(StorageChunk* chunk, uint32_t index, uint32_t count)
+{
+    for (size_t i = 0; i < layout_.columns_.size(); ++i)
+        InitializeColumn(i, (unsigned char*)chunk->GetColumn(i) + layout_.columns_[i].stateSize_ * index, count);
+}
+
+void EntityDefinition::InitializeColumn(size_t flatIndex, void* states, uint32_t count)
+{
+    if (!count)
+        return;
+
+    const uint32_t protoOffset = prototypeOffsets_[flatIndex];
+    if (protoOffset == (uint32_t)-1)
+    {
+        components_[flatIndex]->_InitializeStates(states, count);
+        return;
+    }
+
+    // Copy the prototype once, then keep doubling the initialized run so large batches are a handful of wide copies
+    const size_t stride = layout_.columns_[flatIndex].stateSize_;
+    unsigned char* dest = (unsigned char*)states;
+    memcpy(dest, prototype_.data() + protoOffset, stride);
+    for (uint32_t done = 1; done < count; )
+    {
+        const uint32_t run = std::min(done, count - done);
+        memcpy(dest + done * stride, dest, run * stride);
+        done += run;
+    }
+}
+
 ComponentBase* EntityDefinition::GetComponent(CompID bitIndex)
 {
+    if (!mask_.test(bitIndex))
+        return 0x0;
+    if (flags_ & EDF_Sealed)
+        return components_[layout_.flatIndex_[bitIndex]];
     return components_[FlatIndex(mask_, bitIndex)];
 }
 
@@ -31,8 +108,8 @@ ComponentBase* EntityDefinition::GetComponent(const char* typeName)
 
 ComponentBase* EntityDefinition::AddComponent(CompID compID)
 {
-    assert(!(flags_ & EDF_Sealed), "Attempting to add components to a sealed entity");
-    if (!(flags_ & EDF_Sealed))
+    assert(!(flags_ & EDF_Sealed) && "Attempting to add components to a sealed entity");
+    if (flags_ & EDF_Sealed)
         return 0x0;
 
     ComponentBase* newInstance = 0x0;
@@ -43,15 +120,15 @@ ComponentBase* EntityDefinition::AddComponent(CompID compID)
     mask_.set(compID, true);
     size_t insertIndex = FlatIndex(mask_, compID);
     components_.insert(components_.begin() + insertIndex, newInstance);
-    // TODO: calculate allocation size
+    EntityDatabase::GetInstance()->DefinitionChanged(this);
 
     return newInstance;
 }
 
 ComponentBase* EntityDefinition::AddComponent(const char* typeName)
 {
-    assert(!(flags_ & EDF_Sealed), "Attempting to add components to a sealed entity");
-    if (!(flags_ & EDF_Sealed))
+    assert(!(flags_ & EDF_Sealed) && "Attempting to add components to a sealed entity");
+    if (flags_ & EDF_Sealed)
         return 0x0;
 
     uint32_t foundID = Global_ComponentRegistry()->GetIndexFromTypeName(typeName);
@@ -63,8 +140,8 @@ ComponentBase* EntityDefinition::AddComponent(const char* typeName)
 
 void EntityDefinition::RemoveComponent(CompID compID)
 {
-    assert(!(flags_ & EDF_Sealed), "Attempting to remove components from a sealed entity");
-    if (!(flags_ & EDF_Sealed))
+    assert(!(flags_ & EDF_Sealed) && "Attempting to remove components from a sealed entity");
+    if (flags_ & EDF_Sealed)
         return;
 
     if (!mask_.test(compID))
@@ -75,13 +152,13 @@ void EntityDefinition::RemoveComponent(CompID compID)
     components_.erase(components_.begin() + eraseIndex);
 
     mask_.set(compID, false);
-    // TODO recalculate our stateSize_
+    EntityDatabase::GetInstance()->DefinitionChanged(this);
 }
 
 void EntityDefinition::RemoveComponent(const char* typeName)
 {
-    assert(!(flags_ & EDF_Sealed), "Attempting to remove components from a sealed entity");
-    if (!(flags_ & EDF_Sealed))
+    assert(!(flags_ & EDF_Sealed) && "Attempting to remove components from a sealed entity");
+    if (flags_ & EDF_Sealed)
         return;
 
     uint32_t foundID = Global_ComponentRegistry()->GetIndexFromTypeName(typeName);
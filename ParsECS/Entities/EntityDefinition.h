@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../ParsecDef.h"
+#include "../AlignedAllocator.h"
 #include "../Aspect.h"
+#include "EntityStorage.h"
 
 #include <vector>
 
@@ -19,14 +21,30 @@ struct EntityDefinition
     ~EntityDefinition();
 
     /// Index in the entity-def table
-    uint32_t id_;
+    uint32_t id_ = 0;
     /// 
-    uint32_t tag_;
+    uint32_t tag_ = 0;
     /// Size of the all component states
-    uint32_t stateSize_;
-    uint32_t flags_;
+    uint32_t stateSize_ = 0;
+    uint32_t flags_ = EDF_None;
     char name_[64];
     ComponentBits mask_;
+    /// Chunk layout used by the EntityStorage of this definition along with the per-type flat index and offset tables, valid once sealed.
+    ChunkLayout layout_;
+
+    /// Initialized states of the prototyped components, built when sealed. Each state is aligned for its type.
+    std::vector<unsigned char, AlignedAllocator<unsigned char> > prototype_;
+    /// Offset of each column's state in prototype_ in flat order, -1 for columns initialized per instance.
+    std::vector<uint32_t> prototypeOffsets_;
+
+    /// Finalizes the component set, calculates the stateSize_, storage layout and prototype.
+    void Seal();
+    /// Initializes the states of count consecutive entities in a chunk, starting at index.
+    void InitializeStates(StorageChunk* chunk, uint32_t index, uint32_t count);
+    /// Initializes count consecutive states of the column at the given flat index.
+    void InitializeColumn(size_t flatIndex, void* states, uint32_t count);
+    /// Returns true if the definition has been sealed and may be instantiated.
+    bool IsSealed() const { return (flags_ & EDF_Sealed) != 0; }
 
 // Component Retrieval
     // Components are implicitly determined by the mask and id
@@ -34,14 +52,14 @@ struct EntityDefinition
     ComponentBase* GetComponent(const char* typeName);
 
     template<typename T>
-    T* GetComponent() { return (T*)GetComponent(index); }
+    T* GetComponent() { return (T*)GetComponent(T::TypeID); }
 
 // Component Addition
     ComponentBase* AddComponent(CompID compID);
     ComponentBase* AddComponent(const char* typeName);
 
     template<typename T>
-    T* AddComponent() { return AddComponent(T::TypeID); }
+    T* AddComponent() { return (T*)AddComponent(T::TypeID); }
 
 // Component removal
     void RemoveComponent(CompID compID);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "../ParsecDef.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Kinds of structural change an EntityManager reports.
+enum EntityEventType
+{
+    EET_Added,
+    EET_Removed,
+    EET_Promoted,
+    EET_Count
+};
+
+/// Run of an event stream's IDs that share a definition.
+struct EntityEventSpan
+{
+    DefID defID_;
+    uint32_t begin_;
+    uint32_t count_;
+};
+
+/// Log of one kind of entity event, the IDs are grouped into spans by definition.
+/// Consecutive appends for the same definition extend the last span instead of starting a new one.
+class EntityEventStream
+{
+public:
+    /// Append the IDs of entities of one definition.
+    void Append(DefID defID, const EntityID* ids, size_t count)
+    {
+        if (!count)
+            return;
+        if (spans_.empty() || spans_.back().defID_ != defID)
+            spans_.push_back({ defID, (uint32_t)ids_.size(), 0 });
+        ids_.insert(ids_.end(), ids, ids + count);
+        spans_.back().count_ += (uint32_t)count;
+    }
+
+    /// Discard all events.
+    void Clear() { ids_.clear(); spans_.clear(); }
+
+    /// All IDs in the order they were appended.
+    const std::vector<EntityID>& GetIDs() const { return ids_; }
+    /// Spans of GetIDs() by definition.
+    const std::vector<EntityEventSpan>& GetSpans() const { return spans_; }
+    /// Total number of events.
+    size_t GetCount() const { return ids_.size(); }
+
+private:
+    std::vector<EntityID> ids_;
+    std::vector<EntityEventSpan> spans_;
+};
\ No newline at end of file
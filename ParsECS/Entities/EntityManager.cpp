@@ -4,26 +4,47 @@
 #include "../Components/ComponentRegistry.h"
 #include "EntityDatabase.h"
 #include "EntityDefinition.h"
+#include "EntityObserver.h"
+#include "CommandBuffer.h"
+#include "EntityStorage.h"
+#include "SparseSet.h"
 #include "../MemoryAllocator.h"
 #include "../SimWorld.h"
+#include "../../SysHub/JobSystem.h"
 
-EntityManager::Callback::Callback(EntityManager* manager, size_t listOffset, std::function<void(Entity*)> function) : 
-    manager_(manager),
-    function_(function),
-    listOffset_(listOffset)
+#include <algorithm>
+#include <cstring>
+
+EntityManager::EntityManager(SimWorld* world) :
+    world_(world),
+    commandBuffers_(PARSECS_MAX_THREADS, 0x0)
 {
 }
 
-EntityManager::Callback::~Callback()
+EntityManager::~EntityManager()
 {
-    EntityManager::CallbackList* list = (EntityManager::CallbackList*)(manager_ + listOffset_);
-    if (list)
-    {
-        auto& l = *list;
-        auto found = std::find(l.begin(), l.end(), this);
-        if (found != l.end())
-            l.erase(found);
-    }
+    for (auto observer : observers_)
+        observer->manager_ = 0x0;
+    observers_.clear();
+
+    for (auto storage : storages_)
+        delete storage;
+    storages_.clear();
+
+    for (auto buffer : commandBuffers_)
+        delete buffer;
+    commandBuffers_.clear();
+    for (auto& buffer : threadBuffers_)
+        delete buffer.second;
+    threadBuffers_.clear();
+
+    for (auto set : sparseSets_)
+        delete set;
+    sparseSets_.clear();
+
+    for (auto page : slotPages_)
+        delete[] page;
+    slotPages_.clear();
 }
 
 Entity* EntityManager::CreateEntity(DefID id)
@@ -44,7 +65,8 @@ Entity* EntityManager::CreateEntity(EntityDefinition* definition)
 
     Entity* ret = AllocateEntity();
     ret->defId_ = definition->id_;
-    ret->components_ = 0x0;
+    ret->definition_ = definition;
+    ret->chunk_ = 0x0;
     ret->mask_ = definition->mask_;
     if (inExecution_)
         pendingAddition_.push_back(ret);
@@ -54,6 +76,78 @@ Entity* EntityManager::CreateEntity(EntityDefinition* definition)
     return ret;
 }
 
+size_t EntityManager::CreateEntities(EntityDefinition* definition, size_t count, EntityID* outIds)
+{
+    assert(definition);
+
+    std::vector<Entity*> created;
+    AllocateEntities(definition, count, created);
+    if (outIds)
+    {
+        for (size_t i = 0; i < created.size(); ++i)
+            outIds[i] = created[i]->id_;
+    }
+
+    if (inExecution_)
+    {
+        pendingAddition_.insert(pendingAddition_.end(), created.begin(), created.end());
+        return created.size();
+    }
+
+    FillNewEntities(created.data(), created.size(), definition);
+    return created.size();
+}
+
+void EntityManager::AllocateEntities(EntityDefinition* definition, size_t count, std::vector<Entity*>& created)
+{
+    created.reserve(created.size() + count);
+    entities_.reserve(entities_.size() + count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        Entity* ent = AllocateEntity();
+        if (!ent)
+            break;
+        ent->defId_ = definition->id_;
+        ent->definition_ = definition;
+        ent->chunk_ = 0x0;
+        ent->mask_ = definition->mask_;
+        created.push_back(ent);
+    }
+}
+
+void EntityManager::FillNewEntities(Entity* const* entities, size_t count, EntityDefinition* definition, bool notify)
+{
+    std::vector<EntityID> ids(count);
+    for (size_t i = 0; i < count; ++i)
+        ids[i] = entities[i]->id_;
+
+    // Fill chunk by chunk, each column of a chunk range is initialized with a single call
+    EntityStorage* storage = GetStorage(definition);
+    size_t filled = 0;
+    while (filled < count)
+    {
+        uint32_t index = 0, allocated = 0;
+        StorageChunk* chunk = storage->AllocateRange(ids.data() + filled, (uint32_t)(count - filled), index, allocated);
+        assert(chunk);
+        if (!chunk)
+            break;
+
+        definition->InitializeStates(chunk, index, allocated);
+        chunk->MarkAllAdded(GetChangeVersion());
+
+        for (uint32_t i = 0; i < allocated; ++i)
+        {
+            entities[filled + i]->chunk_ = chunk;
+            entities[filled + i]->chunkIndex_ = index + i;
+        }
+        filled += allocated;
+    }
+
+    if (notify)
+        Publish(EET_Added, entities, filled);
+}
+
 void EntityManager::DestroyEntity(Entity* entity)
 {
     assert(entity);
@@ -63,82 +157,223 @@ void EntityManager::DestroyEntity(Entity* entity)
 
 void EntityManager::DestroyEntity(EntityID entity)
 {
-    auto actualIndex = indirectionTable_.find(entity);
-    if (actualIndex == indirectionTable_.end())
+    Entity* record = GetEntity(entity);
+    if (!record)
         return;
 
-    // usual case
-    if (entities_.size() > 1)
+    if (inExecution_)
     {
-        auto& tail = entities_[listTail_];
-        indirectionTable_[tail.second] = actualIndex->second;
-        std::swap(entities_[actualIndex->second], tail);
-        
-        --listTail_;
-        actualIndex->second = -1;
+        pendingRemoval_.push_back(entity);
+        return;
     }
-    else
+
+    Publish(EET_Removed, &record, 1);
+    ReleaseState(record);
+    ReleaseEntity(record);
+}
+
+void EntityManager::DestroyEntities(const EntityID* ids, size_t count)
+{
+    if (inExecution_)
+    {
+        pendingRemoval_.insert(pendingRemoval_.end(), ids, ids + count);
+        return;
+    }
+
+    std::vector<Entity*> destroyed;
+    destroyed.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        if (Entity* record = GetEntity(ids[i]))
+            destroyed.push_back(record);
+
+    // Release from the back of each storage first, the entities that get moved into vacated slots are then never ones being destroyed
+    std::sort(destroyed.begin(), destroyed.end(), [](const Entity* lhs, const Entity* rhs) {
+        if (lhs->defId_ != rhs->defId_)
+            return lhs->defId_ < rhs->defId_;
+        const uint32_t lhsChunk = lhs->chunk_ ? lhs->chunk_->index_ : 0;
+        const uint32_t rhsChunk = rhs->chunk_ ? rhs->chunk_->index_ : 0;
+        if (lhsChunk != rhsChunk)
+            return lhsChunk > rhsChunk;
+        if (lhs->chunkIndex_ != rhs->chunkIndex_)
+            return lhs->chunkIndex_ > rhs->chunkIndex_;
+        return lhs < rhs;
+    });
+    destroyed.erase(std::unique(destroyed.begin(), destroyed.end()), destroyed.end());
+
+    Publish(EET_Removed, destroyed.data(), destroyed.size());
+    for (auto record : destroyed)
     {
-        --listTail_;
+        ReleaseState(record);
+        ReleaseEntity(record);
     }
 }
 
-Entity* EntityManager::GetEntity(uint32_t id)
+ComponentState* EntityManager::AddSparseState(Entity* entity, CompID typeID)
 {
-    auto actualIndex = indirectionTable_.find(id);
-    if (actualIndex != indirectionTable_.end())
-        return entities_[actualIndex->second].first;
-    return 0x0;
+    assert(entity && ComponentRegistry::IsSparse(typeID));
+
+    SparseSet* set = GetSparseSet(typeID);
+    assert(set && "Sparse set must be created through GetSparseSet<T>() before use");
+    if (!set)
+        return 0x0;
+
+    entity->sparseMask_.set(typeID);
+    return set->Add(entity->id_);
+}
+
+void EntityManager::RemoveSparseState(Entity* entity, CompID typeID)
+{
+    assert(entity);
+    if (!entity->sparseMask_.test(typeID))
+        return;
+
+    sparseSets_[typeID]->Remove(entity->id_);
+    entity->sparseMask_.reset(typeID);
+}
+
+ComponentState* EntityManager::GetSparseState(Entity* entity, CompID typeID)
+{
+    assert(entity);
+    if (!entity->sparseMask_.test(typeID))
+        return 0x0;
+    return sparseSets_[typeID]->Get(entity->id_);
+}
+
+SparseSet* EntityManager::CreateSparseSet(CompID typeID, ComponentBase* component)
+{
+    assert(ComponentRegistry::IsSparse(typeID) && "Component must be registered with SP_Sparse storage");
+
+    if (typeID >= sparseSets_.size())
+        sparseSets_.resize(typeID + 1, 0x0);
+    assert(!sparseSets_[typeID]);
+    return sparseSets_[typeID] = new SparseSet(typeID, component);
+}
+
+void EntityManager::ReleaseEntity(Entity* entity)
+{
+    if (entity->sparseMask_.any())
+    {
+        for (CompID i = 0; i < sparseSets_.size(); ++i)
+            if (entity->sparseMask_.test(i))
+                sparseSets_[i]->Remove(entity->id_);
+    }
+
+    // Swap the last live entity into our place in the dense list
+    const uint32_t index = EntityIndex(entity->id_);
+    EntitySlot& slot = GetSlot(index);
+    Entity* last = entities_.back();
+    entities_[slot.link_] = last;
+    GetSlot(EntityIndex(last->id_)).link_ = slot.link_;
+    entities_.pop_back();
+
+    // Retire the handle and return the slot to the free list. A slot whose generation would wrap is never reused,
+    // otherwise a handle kept across that many reuses would resolve to an unrelated entity.
+    slot.generation_ = (slot.generation_ + 1) & PARSECS_ENTITY_GENERATION_MASK;
+    slot.entity_ = Entity();
+    if (slot.generation_ == 0)
+    {
+        slot.link_ = -1;
+        ++retiredSlots_;
+        return;
+    }
+    slot.link_ = freeSlot_;
+    freeSlot_ = index;
 }
 
 void EntityManager::GetEntities(const ComponentBits& mask, std::vector<Entity*>& entities)
 {
-    const size_t count = mask.count();
-    for (unsigned i = 0; i < listTail_; ++i)
+    for (auto ent : entities_)
     {
-        auto& ent = entities_[i];
-        if ((ent.first->mask_ & mask).count() == count)
-            entities.push_back(ent.first);
+        if (ent->mask_.Contains(mask))
+            entities.push_back(ent);
     }
 }
 
 void EntityManager::GetEntities(const Aspect& aspect, std::vector<Entity*>& entities)
 {
-    for (unsigned i = 0; i < listTail_; ++i)
+    // Only the storages of matching definitions are visited, other entities are never touched
+    std::vector<EntityDefinition*> definitions;
+    EntityDatabase::GetInstance()->GetMatchingDefinitions(aspect, definitions);
+    for (auto definition : definitions)
     {
-        auto& ent = entities_[i];
-        if (aspect.Passes(ent.first->mask_))
-            entities.push_back(ent.first);
+        if (definition->id_ >= storages_.size() || !storages_[definition->id_])
+            continue;
+
+        EntityStorage* storage = storages_[definition->id_];
+        entities.reserve(entities.size() + storage->GetEntityCount());
+        for (size_t c = 0; c < storage->GetChunkCount(); ++c)
+        {
+            StorageChunk* chunk = storage->GetChunk(c);
+            const EntityID* ids = chunk->GetIDs();
+            for (uint32_t i = 0; i < chunk->count_; ++i)
+                entities.push_back(GetEntity(ids[i]));
+        }
     }
 }
 
 void EntityManager::for_each(const ComponentBits& mask, std::function<void(Entity*)> function)
 {
-    for (unsigned i = 0; i < listTail_; ++i)
+    for (auto ent : entities_)
     {
-        auto& ent = entities_[i];
-        if ((ent.first->mask_ & mask).count())
-            function(ent.first);
+        if (ent->mask_.Intersects(mask))
+            function(ent);
     }
 }
 
 void EntityManager::for_each(const Aspect& aspect, std::function<void(Entity*)> function)
 {
-    for (unsigned i = 0; i < listTail_; ++i)
+    // Gathered first, the function may create or destroy entities which moves them around in storage
+    std::vector<Entity*> matching;
+    GetEntities(aspect, matching);
+    for (auto ent : matching)
+        function(ent);
+}
+
+void EntityManager::GetRanges(const Aspect& aspect, std::vector<QueryRange>& ranges, uint32_t maxRangeSize)
+{
+    std::vector<EntityDefinition*> definitions;
+    EntityDatabase::GetInstance()->GetMatchingDefinitions(aspect, definitions);
+    for (auto definition : definitions)
     {
-        auto& ent = entities_[i];
-        if (aspect.Passes(ent.first->mask_))
-            function(ent.first);
+        if (definition->id_ >= storages_.size() || !storages_[definition->id_])
+            continue;
+
+        EntityStorage* storage = storages_[definition->id_];
+        for (size_t c = 0; c < storage->GetChunkCount(); ++c)
+        {
+            StorageChunk* chunk = storage->GetChunk(c);
+            const uint32_t step = maxRangeSize ? maxRangeSize : chunk->count_;
+            for (uint32_t begin = 0; begin < chunk->count_; begin += step)
+                ranges.push_back({ chunk, begin, std::min(chunk->count_, begin + step) });
+        }
     }
 }
 
+void EntityManager::parallel_for_each(JobSystem* jobs, const Aspect& aspect, std::function<void(const QueryRange&, size_t)> kernel, uint32_t maxRangeSize)
+{
+    std::vector<QueryRange> ranges;
+    GetRanges(aspect, ranges, maxRangeSize);
+
+    if (!jobs)
+    {
+        for (size_t i = 0; i < ranges.size(); ++i)
+            kernel(ranges[i], i);
+        return;
+    }
+
+    // Ranges are already sized for cache locality, each job takes one
+    jobs->ParallelFor(0, ranges.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            kernel(ranges[i], i);
+    });
+}
+
 void EntityManager::for_each(DefID defID, std::function<void(Entity*)> function)
 {
-    for (unsigned i = 0; i < listTail_; ++i)
+    for (auto ent : entities_)
     {
-        auto& ent = entities_[i];
-        if (ent.first->defId_ == defID)
-            function(ent.first);
+        if (ent->defId_ == defID)
+            function(ent);
     }
 }
 
@@ -147,138 +382,473 @@ void EntityManager::for_each(EntityDefinition* definition, std::function<void(En
     for_each(definition->id_, function); 
 }
 
-void EntityManager::ResolvePending()
+CommandBuffer* EntityManager::GetCommandBuffer()
 {
-    // Process removals first, because addition events may result in growing arrays
-    for (auto& entity : pendingRemoval_)
+    // Only the owning worker ever touches its slot, the table itself never grows
+    const unsigned index = JobSystem::GetThreadIndex();
+    if (index && index < commandBuffers_.size())
     {
-
+        CommandBuffer*& buffer = commandBuffers_[index];
+        if (!buffer)
+            buffer = new CommandBuffer();
+        return buffer;
     }
 
-    for (auto& entity : pendingAddition_)
+    // Index 0 is shared by the main thread and any other thread outside the JobSystem, so those are told apart by id
+    const std::thread::id thread = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(threadBuffersLock_);
+    for (auto& buffer : threadBuffers_)
+        if (buffer.first == thread)
+            return buffer.second;
+    threadBuffers_.push_back(std::make_pair(thread, new CommandBuffer()));
+    return threadBuffers_.back().second;
+}
+
+void EntityManager::GatherCommandBuffers(std::vector<CommandBuffer*>& buffers) const
+{
+    buffers.clear();
+    for (auto buffer : commandBuffers_)
+        if (buffer)
+            buffers.push_back(buffer);
+
+    std::lock_guard<std::mutex> lock(threadBuffersLock_);
+    for (auto& buffer : threadBuffers_)
+        buffers.push_back(buffer.second);
+}
+
+void EntityManager::ResolvePending()
+{
+    assert(!inExecution_);
+
+    // The commands are taken out of the buffers before they are applied, initializers may record into them again
+    // and whatever they record is resolved in another round
+    std::vector<CommandBuffer*> buffers;
+    std::vector<CommandBuffer> recorded;
+    for (;;)
     {
+        GatherCommandBuffers(buffers);
+        recorded.resize(buffers.size());
+        bool pending = !pendingRemoval_.empty() || !pendingAddition_.empty();
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            recorded[i].Clear();
+            recorded[i].Swap(*buffers[i]);
+            pending |= !recorded[i].IsEmpty();
+        }
+        if (!pending)
+            break;
+        ApplyCommands(recorded);
+    }
+}
 
+void EntityManager::ApplyCommands(std::vector<CommandBuffer>& buffers)
+{
+    std::vector<CommandBuffer::Command*> promotions;
+    std::vector<CommandBuffer::Command*> creations;
+    std::vector<std::pair<CommandBuffer*, CommandBuffer::Command*> > sparse;
+    std::vector<EntityID> destroyed(pendingRemoval_);
+    for (auto& buffer : buffers)
+    {
+        for (auto& command : buffer.commands_)
+        {
+            switch (command.type_)
+            {
+            case CommandBuffer::CMD_Destroy: destroyed.push_back(command.entity_); break;
+            case CommandBuffer::CMD_Promote: promotions.push_back(&command); break;
+            case CommandBuffer::CMD_Create: creations.push_back(&command); break;
+            default: sparse.push_back(std::make_pair(&buffer, &command)); break;
+            }
+        }
     }
 
+    // Process removals first, they free storage and turn any other command on those entities into a no-op
+    DestroyEntities(destroyed.data(), destroyed.size());
     pendingRemoval_.clear();
+
+    // Promotions and additions are grouped by target definition so that each group moves or fills contiguous ranges
+    auto byDefinition = [](const CommandBuffer::Command* lhs, const CommandBuffer::Command* rhs) { return lhs->definition_->id_ < rhs->definition_->id_; };
+    std::stable_sort(promotions.begin(), promotions.end(), byDefinition);
+    std::vector<EntityID> ids;
+    for (size_t start = 0; start < promotions.size(); )
+    {
+        EntityDefinition* definition = promotions[start]->definition_;
+        ids.clear();
+        size_t end = start;
+        for (; end < promotions.size() && promotions[end]->definition_ == definition; ++end)
+            ids.push_back(promotions[end]->entity_);
+        PromoteEntities(ids.data(), ids.size(), definition);
+        start = end;
+    }
+
+    // Entities created while locked already have their slots, only their states are pending
+    std::vector<Entity*> additions;
+    for (auto entity : pendingAddition_)
+        if (GetEntity(entity->id_) == entity && !entity->chunk_)
+            additions.push_back(entity);
     pendingAddition_.clear();
+    std::stable_sort(additions.begin(), additions.end(), [](const Entity* lhs, const Entity* rhs) { return lhs->defId_ < rhs->defId_; });
+    for (size_t start = 0; start < additions.size(); )
+    {
+        size_t end = start + 1;
+        while (end < additions.size() && additions[end]->definition_ == additions[start]->definition_)
+            ++end;
+        FillNewEntities(additions.data() + start, end - start, additions[start]->definition_);
+        start = end;
+    }
+
+    // Creations are announced only after their initializers ran, so observers never see default states
+    std::stable_sort(creations.begin(), creations.end(), byDefinition);
+    std::vector<Entity*> created;
+    for (size_t start = 0; start < creations.size(); )
+    {
+        EntityDefinition* definition = creations[start]->definition_;
+        size_t end = start;
+        while (end < creations.size() && creations[end]->definition_ == definition)
+            ++end;
+
+        const size_t first = created.size();
+        AllocateEntities(definition, end - start, created);
+        FillNewEntities(created.data() + first, created.size() - first, definition, false);
+        for (size_t i = first; i < created.size(); ++i)
+            creations[start + i - first]->entity_ = created[i]->id_;
+        start = end;
+    }
+
+    // Initializers run once every creation exists, they may reference each other's results through their own captures
+    for (auto& buffer : buffers)
+    {
+        for (auto& command : buffer.commands_)
+        {
+            if (command.type_ != CommandBuffer::CMD_Create || !buffer.initializers_[command.payload_])
+                continue;
+            if (Entity* entity = GetEntity(command.entity_))
+                buffer.initializers_[command.payload_](entity);
+        }
+    }
+    Publish(EET_Added, created.data(), created.size());
+
+    // Sparse changes keep their recorded order so that an add followed by a remove on one thread resolves as expected
+    for (auto& change : sparse)
+    {
+        CommandBuffer::Command& command = *change.second;
+        Entity* entity = GetEntity(command.entity_);
+        if (!entity)
+            continue;
+
+        if (command.type_ == CommandBuffer::CMD_RemoveSparse)
+            RemoveSparseState(entity, command.typeID_);
+        else if (ComponentState* state = AddSparseState(entity, command.typeID_))
+        {
+            if (command.payloadSize_)
+                memcpy(state, change.first->data_.data() + command.payload_, command.payloadSize_);
+        }
+    }
 }
 
 Entity* EntityManager::AllocateEntity()
 {
-    if (listTail_ < entities_.size())
+    uint32_t index = freeSlot_;
+    if (index != (uint32_t)-1)
+        freeSlot_ = GetSlot(index).link_;
+    else
     {
-        auto record = entities_[listTail_];
-        indirectionTable_[record.first->id_] = listTail_ - 1;
-        ++listTail_;
-        return record.first;
-    }    
-    
-    return 0x0;
+        // The last index is reserved so that a handle can never be -1
+        assert(slotCount_ < PARSECS_ENTITY_INDEX_MASK);
+        if (slotCount_ >= PARSECS_ENTITY_INDEX_MASK)
+            return 0x0;
+
+        if (slotCount_ % SlotPageSize == 0)
+            slotPages_.push_back(new EntitySlot[SlotPageSize]);
+        index = slotCount_++;
+    }
+
+    EntitySlot& slot = GetSlot(index);
+    slot.entity_.id_ = MakeEntityID(index, slot.generation_);
+    slot.link_ = (uint32_t)entities_.size();
+    entities_.push_back(&slot.entity_);
+    return &slot.entity_;
+}
+
+EntityStorage* EntityManager::GetStorage(EntityDefinition* definition)
+{
+    assert(definition && definition->IsSealed());
+
+    if (definition->id_ >= storages_.size())
+        storages_.resize(definition->id_ + 1, 0x0);
+
+    auto& storage = storages_[definition->id_];
+    if (!storage)
+    {
+        // Instantiated definitions must be known to the database for aspect queries to find them
+        EntityDatabase* database = EntityDatabase::GetInstance();
+        if (!database->IsRegistered(definition))
+            database->RegisterDefinition(definition);
+        storage = new EntityStorage(definition->id_, &definition->layout_, world_->GetMemoryManager(), &changeVersion_, world_->GetThreadCachedMemory());
+    }
+    return storage;
 }
 
 void EntityManager::FillNewEntity(Entity* entity, EntityDefinition* definition)
 {
-    //TODO allocate entity data
-    entity->components_ = (ComponentState*)world_->GetMemoryManager()->Allocate(definition->stateSize_);
+    entity->chunk_ = GetStorage(definition)->Allocate(entity->id_, entity->chunkIndex_);
     
-    assert(entity->components_);
+    assert(entity->chunk_);
     // did allocation fail?
+    if (!entity->chunk_)
+        return;
 
-    size_t offset = 0;
-    for (auto comp : definition->components_)
+    definition->InitializeStates(entity->chunk_, entity->chunkIndex_, 1);
+    entity->chunk_->MarkAllAdded(GetChangeVersion());
+
+    Publish(EET_Added, &entity, 1);
+}
+
+void EntityManager::ReleaseState(Entity* entity)
+{
+    if (!entity->chunk_)
+        return;
+
+    EntityID moved = entity->chunk_->storage_->Free(entity->chunk_, entity->chunkIndex_);
+    if (moved != (EntityID)-1)
     {
-        void* addr = ((unsigned char*)entity->components_) + offset;
-        comp->_InitializeState(addr);
-        offset += comp->StateSize();
+        if (Entity* movedEntity = GetEntity(moved))
+        {
+            movedEntity->chunk_ = entity->chunk_;
+            movedEntity->chunkIndex_ = entity->chunkIndex_;
+        }
     }
+
+    entity->chunk_ = 0x0;
+    entity->chunkIndex_ = 0;
+}
+
+void EntityManager::PromoteEntity(Entity* entity, EntityDefinition* toDefinition)
+{
+    assert(entity && toDefinition);
+    PromoteEntities(&entity, 1, toDefinition);
 }
 
-void EntityManager::PromoteEntity(Entity* entity, EntityDefinition* fromDefinition, EntityDefinition* toDefinition)
+void EntityManager::PromoteEntities(const EntityID* ids, size_t count, EntityDefinition* toDefinition)
 {
-    assert(entity && fromDefinition && toDefinition);
+    std::vector<Entity*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        if (Entity* record = GetEntity(ids[i]))
+            records.push_back(record);
+    PromoteEntities(records.data(), records.size(), toDefinition);
+}
+
+void EntityManager::PromoteEntities(Entity* const* entities, size_t count, EntityDefinition* toDefinition)
+{
+    assert(toDefinition);
 
-    // do we need to do anything?
-    if (entity->components_ && fromDefinition != toDefinition)
+    // Entities without storage just switch definition, the rest are grouped by their source definition
+    std::vector<Entity*> moving;
+    moving.reserve(count);
+    for (size_t i = 0; i < count; ++i)
     {
-        // Is this entity really changing?
-        if (fromDefinition->mask_ != toDefinition->mask_)
+        Entity* entity = entities[i];
+        if (!entity || entity->definition_ == toDefinition)
+            continue;
+        if (entity->chunk_)
+            moving.push_back(entity);
+        else
         {
-            void* readData = entity->components_;
-            void* newData = 0x0;
-            if (toDefinition->stateSize_ > fromDefinition->stateSize_)
-                newData = world_->GetMemoryManager()->Allocate(toDefinition->stateSize_);
-            else
-                newData = new char[toDefinition->stateSize_];
+            entity->defId_ = toDefinition->id_;
+            entity->definition_ = toDefinition;
+            entity->mask_ = toDefinition->mask_;
+            FillNewEntity(entity, toDefinition);
+        }
+    }
+    if (moving.empty())
+        return;
 
-            ComponentBits compUnion = fromDefinition->mask_ & toDefinition->mask_;
-            if (compUnion.any())
-            {
-                size_t fromOffset = 0, toOffset = 0;
-                for (unsigned i = 0, offset = 0; i < compUnion.size(); ++i)
-                {
-                    if (compUnion[i])
-                    {
-                        toDefinition->GetComponent(i)->_ConvertState(fromDefinition->GetComponent(i), (char*)readData + fromOffset, (char*)newData + toOffset);
-                        fromOffset += ComponentRegistry::GetDataSize(i);
-                        toOffset += ComponentRegistry::GetDataSize(i);
-                    }
-                    else if (fromDefinition->mask_[i])
-                        fromOffset += ComponentRegistry::GetDataSize(i);
-                    else if (toDefinition->mask_[i])
-                    {
-                        // Prepare new component data
-                        toDefinition->GetComponent(i)->_InitializeState((char*)readData + offset);
-                        toOffset += ComponentRegistry::GetDataSize(i);
-                    }
-                }
-            }
-            if (toDefinition->stateSize_ > fromDefinition->stateSize_)
-            {
-                memcpy(entity->components_, newData, toDefinition->stateSize_);
-                delete[] newData;
-            }
-            else
+    // Duplicates have to end up adjacent for unique, a second move of the same entity would free the slot it was just moved into
+    std::sort(moving.begin(), moving.end(), [](const Entity* lhs, const Entity* rhs) {
+        if (lhs->defId_ != rhs->defId_)
+            return lhs->defId_ < rhs->defId_;
+        return lhs < rhs;
+    });
+    moving.erase(std::unique(moving.begin(), moving.end()), moving.end());
+
+    for (size_t start = 0; start < moving.size(); )
+    {
+        size_t end = start + 1;
+        while (end < moving.size() && moving[end]->definition_ == moving[start]->definition_)
+            ++end;
+        PromoteGroup(moving.data() + start, end - start, moving[start]->definition_, toDefinition);
+        start = end;
+    }
+
+    Publish(EET_Promoted, moving.data(), moving.size());
+}
+
+void EntityManager::PromoteGroup(Entity* const* entities, size_t count, EntityDefinition* fromDefinition, EntityDefinition* toDefinition)
+{
+    assert(fromDefinition && toDefinition && fromDefinition != toDefinition);
+
+    const PromotionPlan& plan = GetPromotionPlan(fromDefinition, toDefinition);
+    const ChunkLayout& toLayout = toDefinition->layout_;
+    EntityStorage* storage = GetStorage(toDefinition);
+
+    struct Relocation
+    {
+        Entity* entity_;
+        StorageChunk* chunk_;
+        uint32_t index_;
+    };
+    std::vector<Relocation> relocations(count);
+    std::vector<EntityID> ids(count);
+    for (size_t i = 0; i < count; ++i)
+        ids[i] = entities[i]->id_;
+
+    // Reserve contiguous ranges in the target storage and fill them a column at a time
+    size_t done = 0;
+    while (done < count)
+    {
+        uint32_t index = 0, allocated = 0;
+        StorageChunk* chunk = storage->AllocateRange(ids.data() + done, (uint32_t)(count - done), index, allocated);
+        assert(chunk);
+        if (!chunk)
+            return;
+
+        Entity* const* range = entities + done;
+        for (const PromotionStep& step : plan)
+        {
+            const uint32_t stride = toLayout.columns_[step.toColumn_].stateSize_;
+            unsigned char* toStates = (unsigned char*)chunk->GetColumn(step.toColumn_) + stride * index;
+            switch (step.operation_)
             {
-                world_->GetMemoryManager()->Free(entity->components_);
-                entity->components_ = (ComponentState*)newData;
+            case PromotionStep::Copy:
+                for (uint32_t i = 0; i < allocated; ++i)
+                    memcpy(toStates + stride * i, (unsigned char*)range[i]->chunk_->GetColumn(step.fromColumn_) + stride * range[i]->chunkIndex_, stride);
+                break;
+            case PromotionStep::Convert:
+                // Gather the scattered source states so the converter sees contiguous arrays
+                conversionScratch_.resize(stride * allocated);
+                for (uint32_t i = 0; i < allocated; ++i)
+                    memcpy(conversionScratch_.data() + stride * i, (unsigned char*)range[i]->chunk_->GetColumn(step.fromColumn_) + stride * range[i]->chunkIndex_, stride);
+                toDefinition->components_[step.toColumn_]->_ConvertStates(fromDefinition->components_[step.fromColumn_], conversionScratch_.data(), toStates, allocated);
+                break;
+            case PromotionStep::Initialize:
+                toDefinition->InitializeColumn(step.toColumn_, toStates, allocated);
+                chunk->MarkAdded(step.toColumn_, GetChangeVersion());
+                break;
             }
         }
-        else
+
+        for (uint32_t i = 0; i < allocated; ++i)
+            relocations[done + i] = { range[i], chunk, index + i };
+        done += allocated;
+    }
+
+    // Release from the back of the source storage first, the entities moved into vacated slots are then never ones being promoted
+    std::sort(relocations.begin(), relocations.end(), [](const Relocation& lhs, const Relocation& rhs) {
+        if (lhs.entity_->chunk_->index_ != rhs.entity_->chunk_->index_)
+            return lhs.entity_->chunk_->index_ > rhs.entity_->chunk_->index_;
+        return lhs.entity_->chunkIndex_ > rhs.entity_->chunkIndex_;
+    });
+    for (auto& relocation : relocations)
+    {
+        Entity* entity = relocation.entity_;
+        ReleaseState(entity);
+        entity->chunk_ = relocation.chunk_;
+        entity->chunkIndex_ = relocation.index_;
+        entity->defId_ = toDefinition->id_;
+        entity->definition_ = toDefinition;
+        entity->mask_ = toDefinition->mask_;
+    }
+}
+
+const EntityManager::PromotionPlan& EntityManager::GetPromotionPlan(EntityDefinition* fromDefinition, EntityDefinition* toDefinition)
+{
+    const uint64_t key = ((uint64_t)fromDefinition->id_ << 32) | toDefinition->id_;
+    auto found = promotionPlans_.find(key);
+    if (found != promotionPlans_.end())
+        return found->second;
+
+    PromotionPlan& plan = promotionPlans_[key];
+    const ChunkLayout& toLayout = toDefinition->layout_;
+    const ChunkLayout& fromLayout = fromDefinition->layout_;
+    for (uint32_t i = 0; i < toLayout.columns_.size(); ++i)
+    {
+        const CompID typeID = toLayout.columns_[i].typeID_;
+        PromotionStep step = { PromotionStep::Initialize, i, fromLayout.flatIndex_[typeID] };
+        if (step.fromColumn_ != PARSECS_INVALID_FLAT_INDEX)
         {
-            // we're promoting to component identical entity
-            size_t offset = 0;
-            for (size_t i = 0; i < toDefinition->mask_.size(); ++i)
-            {
-                if (toDefinition->mask_[i])
-                {
-                    toDefinition->GetComponent(i)->_ConvertState(fromDefinition->GetComponent(i), (char*)entity->components_ + offset, (char*)entity->components_ + offset);
-                    offset += ComponentRegistry::GetDataSize(i);
-                }
-            }
+            auto& metaData = ComponentRegistry::GetMetaData();
+            const StateConversion conversion = typeID < metaData.size() && metaData[typeID] ? metaData[typeID]->conversion_ : SC_Custom;
+            if (conversion == SC_Keep)
+                step.operation_ = PromotionStep::Copy;
+            else if (conversion == SC_Reset && toDefinition->components_[i]->UsesPrototype())
+                step.operation_ = PromotionStep::Initialize; // a wipe of a trivial state is the same as a fresh one
+            else
+                step.operation_ = PromotionStep::Convert;
         }
+        plan.push_back(step);
     }
-    else if (entity)
-        FillNewEntity(entity, toDefinition);
+    return plan;
 }
 
-EntityManager::Callback* EntityManager::SubscribeEntityAdded(std::function<void(Entity*)> function)
+void EntityManager::AddObserver(EntityObserver* observer)
 {
-    auto call = new EntityManager::Callback(this, offsetof(EntityManager, entityAdded_), function);
-    entityAdded_.push_back(call);
-    return call;
+    assert(observer);
+    if (std::find(observers_.begin(), observers_.end(), observer) == observers_.end())
+        observers_.push_back(observer);
 }
 
-EntityManager::Callback* EntityManager::SubscribeEntityRemoved(std::function<void(Entity*)> function)
+void EntityManager::RemoveObserver(EntityObserver* observer)
 {
-    auto call = new EntityManager::Callback(this, offsetof(EntityManager, entityRemoved_), function);
-    entityRemoved_.push_back(call);
-    return call;
+    auto found = std::find(observers_.begin(), observers_.end(), observer);
+    if (found != observers_.end())
+        observers_.erase(found);
 }
 
-EntityManager::Callback* EntityManager::SubscribeEntityPromoted(std::function<void(Entity*)> function)
+void EntityManager::ClearEvents()
 {
-    auto call = new EntityManager::Callback(this, offsetof(EntityManager, entityPromoted_), function);
-    entityPromoted_.push_back(call);
-    return call;
+    for (auto& stream : events_)
+        stream.Clear();
+}
+
+void EntityManager::Publish(EntityEventType type, Entity* const* entities, size_t count)
+{
+    if (!count || (observers_.empty() && !recordEvents_))
+        return;
+
+    // Local copies, observers may create or destroy entities which publishes again
+    std::vector<EntityID> ids(count);
+    for (size_t i = 0; i < count; ++i)
+        ids[i] = entities[i]->id_;
+    const std::vector<EntityObserver*> observers = observers_;
+
+    for (size_t start = 0; start < count; )
+    {
+        const DefID defID = entities[start]->defId_;
+        size_t end = start + 1;
+        while (end < count && entities[end]->defId_ == defID)
+            ++end;
+
+        const EntityID* span = ids.data() + start;
+        const size_t spanSize = end - start;
+        if (recordEvents_)
+            events_[type].Append(defID, span, spanSize);
+        for (auto observer : observers)
+        {
+            switch (type)
+            {
+            case EET_Added:
+                observer->EntitiesAdded(defID, span, spanSize);
+                break;
+            case EET_Removed:
+                observer->EntitiesRemoved(defID, span, spanSize);
+                break;
+            case EET_Promoted:
+                observer->EntitiesPromoted(defID, span, spanSize);
+                break;
+            default:
+                break;
+            }
+        }
+        start = end;
+    }
 }
\ No newline at end of file
@@ -2,45 +2,106 @@
 
 #include "../ParsecDef.h"
 
+#include "../AlignedAllocator.h"
 #include "../Aspect.h"
 #include "Entity.h"
+#include "EntityEvents.h"
 
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
 BEGIN_PARSECS_NS
 
+struct ComponentBase;
+struct ComponentState;
 struct EntityDefinition;
+class CommandBuffer;
+class EntityStorage;
+class JobSystem;
+class SparseSet;
+struct QueryRange;
 class SimWorld;
+class EntityObserver;
 
 /// Manages the entities of a SimWorld. Responsible for the lifecycle and access.
 class EntityManager
 {
 public:
 
-    struct Callback {
-        Callback(EntityManager* manager, size_t listOffset, std::function<void(Entity*)> function);
-        ~Callback();
-        std::function<void(Entity*)> function_;
-
-    private:
-        EntityManager* manager_ = 0x0;
-        size_t listOffset_;
-    };
+    /// Construct for a simulation world, the world's memory manager supplies the storage chunks.
+    EntityManager(SimWorld* world);
+    /// Destruct and release all entity storage.
+    ~EntityManager();
 
     /// Create an entity from a definition ID.
     Entity* CreateEntity(DefID definitionId);
     /// Create an entity from a definition instance.
     Entity* CreateEntity(EntityDefinition* definition);
 
+    /// Create count entities of a definition, storage is reserved contiguously and states are initialized a column at a time.
+    /// The handles are written to outIds if it is not null. Observers receive a single batched notification.
+    size_t CreateEntities(EntityDefinition* definition, size_t count, EntityID* outIds);
+
+    /// Move an entity to another definition, shared component states are converted and new ones initialized.
+    void PromoteEntity(Entity* entity, EntityDefinition* toDefinition);
+    /// Move a set of entities to another definition using cached per column copy plans.
+    void PromoteEntities(Entity* const* entities, size_t count, EntityDefinition* toDefinition);
+    /// Move a set of entities by ID to another definition. Stale handles are ignored.
+    void PromoteEntities(const EntityID* ids, size_t count, EntityDefinition* toDefinition);
+
     /// Destroy an entity by instance.
     void DestroyEntity(Entity* entity);
     /// Destroy an entity by ID.
     void DestroyEntity(EntityID entity);
+    /// Destroy a set of entities by ID, observers receive a single batched notification. Stale handles are ignored.
+    void DestroyEntities(const EntityID* ids, size_t count);
+
+    /// Adds a sparse component's state to an entity without changing its definition, returns the existing state if present.
+    /// The component's SparseSet must exist, see GetSparseSet<T>().
+    ComponentState* AddSparseState(Entity* entity, CompID typeID);
+    /// Removes a sparse component's state from an entity.
+    void RemoveSparseState(Entity* entity, CompID typeID);
+    /// Retrieves an entity's sparse component state, 0x0 if it does not have the component.
+    ComponentState* GetSparseState(Entity* entity, CompID typeID);
+    /// Retrieves the set of a sparse component type, 0x0 if none has been created.
+    SparseSet* GetSparseSet(CompID typeID) { return typeID < sparseSets_.size() ? sparseSets_[typeID] : 0x0; }
 
-    /// Retrieve an entity by it's handle
-    Entity* GetEntity(EntityID id);
+    /// Retrieves the set of a sparse component type, created with a new instance of T on first use.
+    template<typename T>
+    SparseSet* GetSparseSet()
+    {
+        static_assert(std::is_trivially_copyable<typename T::State>::value, "Sparse component states are relocated bitwise and never destructed");
+        if (SparseSet* set = GetSparseSet(T::TypeID))
+            return set;
+        return CreateSparseSet(T::TypeID, new T());
+    }
+    template<typename T>
+    typename T::State* AddSparseState(Entity* entity) { GetSparseSet<T>(); return (typename T::State*)AddSparseState(entity, T::TypeID); }
+    template<typename T>
+    void RemoveSparseState(Entity* entity) { RemoveSparseState(entity, T::TypeID); }
+    template<typename T>
+    typename T::State* GetSparseState(Entity* entity) { return (typename T::State*)GetSparseState(entity, T::TypeID); }
+
+    /// Retrieve an entity by it's handle, returns 0x0 for stale or invalid handles.
+    inline Entity* GetEntity(EntityID id)
+    {
+        const uint32_t index = EntityIndex(id);
+        if (index >= slotCount_)
+            return 0x0;
+        EntitySlot& slot = GetSlot(index);
+        return slot.entity_.id_ == id ? &slot.entity_ : 0x0;
+    }
+    /// Returns true if the handle refers to a live entity.
+    inline bool IsAlive(EntityID id) { return GetEntity(id) != 0x0; }
+    /// Number of live entities.
+    size_t GetEntityCount() const { return entities_.size(); }
+    /// Number of slots taken out of use because their generation ran out, they count against PARSECS_ENTITY_INDEX_MASK.
+    uint32_t GetRetiredSlotCount() const { return retiredSlots_; }
     /// Retrieve entities that match a bitmask.
     void GetEntities(const ComponentBits& mask, std::vector<Entity*>& entities);
     /// Retrieve entities for which an aspect passes.
@@ -55,6 +116,13 @@ public:
     /// Execute a function object on all entities referencing the given EntityDefinition.
     void for_each(EntityDefinition* definition, std::function<void(Entity*)> function);
 
+    /// Splits the storage of the definitions an aspect matches into ranges of at most maxRangeSize entities, 0 keeps whole chunks.
+    /// Ranges are in a stable order, definition then chunk, so their indices can be used for deterministic results.
+    void GetRanges(const Aspect& aspect, std::vector<QueryRange>& ranges, uint32_t maxRangeSize = 0);
+    /// Runs kernel(range, rangeIndex) for the ranges of an aspect on the job system's threads, returns when all are done.
+    /// Without a job system the ranges run in order on the calling thread. Kernels must not create, destroy or promote entities.
+    void parallel_for_each(JobSystem* jobs, const Aspect& aspect, std::function<void(const QueryRange&, size_t)> kernel, uint32_t maxRangeSize = 0);
+
     /// Locks additions, removals, and promotions in the entity component system from being valid.
     inline void Begin() { inExecution_ = true; }
     /// Unlocks the automatic execution of additions, removals, and promotions.
@@ -70,43 +138,149 @@ public:
     /// Construct a lock object for this manager.
     inline LockObject LockScope() { return LockObject(this); }
 
-    /// Processes pending additions, removals, and promotions after execution has finished.
+    /// Command buffer of the calling thread, for recording structural changes from systems that run in parallel.
+    /// JobSystem workers use a slot of their own, any other thread gets a buffer keyed by its thread id.
+    CommandBuffer* GetCommandBuffer();
+    /// Applies pending removals and additions made while locked along with every thread's command buffer.
+    /// Must be called from a single thread once execution has finished. Removals are applied first, then promotions
+    /// and creations grouped by target definition, then sparse component changes. Created entities are announced
+    /// with EET_Added once their initializers have run. Commands recorded by initializers are resolved before returning.
     void ResolvePending();
 
-    typedef std::function<void(Entity*)> CallbackFunction;
-    Callback* SubscribeEntityAdded(std::function<void(Entity*)> function);
-    Callback* SubscribeEntityRemoved(std::function<void(Entity*)> function);
-    Callback* SubscribeEntityPromoted(std::function<void(Entity*)> function);
+    /// Registers an observer for batched notification of structural changes, see EntityObserver::Connect.
+    void AddObserver(EntityObserver* observer);
+    /// Unregisters an observer.
+    void RemoveObserver(EntityObserver* observer);
+
+    /// Enables recording of the event streams, off by default. Recorded events accumulate until ClearEvents.
+    void SetRecordEvents(bool record) { recordEvents_ = record; }
+    bool IsRecordingEvents() const { return recordEvents_; }
+    /// IDs of the entities an event happened to since the last ClearEvents, grouped into spans by definition.
+    /// Intended to be consumed once per frame by systems that prefer polling over observing.
+    const EntityEventStream& GetEvents(EntityEventType type) const { return events_[type]; }
+    /// Empties the event streams, typically at the end of a frame.
+    void ClearEvents();
 
     SimWorld* GetWorld() const { return world_; }
 
+    /// Current change version, stamped into the chunk columns that are written or receive new states.
+    uint32_t GetChangeVersion() const { return changeVersion_.load(std::memory_order_relaxed); }
+    /// Starts a new change version and returns it. A system runs at a fresh version and later skips
+    /// chunks not stamped since then with Changed<T>/Added<T> view filters.
+    uint32_t AdvanceChangeVersion() { return changeVersion_.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+    /// Retrieve the chunked state storage for a definition, created on first use.
+    EntityStorage* GetStorage(EntityDefinition* definition);
+    /// All storages that have been created, indexed by DefID. Entries may be null.
+    const std::vector<EntityStorage*>& GetStorages() const { return storages_; }
+
 private:
+    /// Slot-map record, slots live in fixed size pages so that Entity pointers stay valid as the table grows.
+    struct EntitySlot
+    {
+        Entity entity_;
+        /// Bumped whenever the slot is released so that old handles no longer resolve. The slot is retired once it wraps.
+        uint32_t generation_ = 0;
+        /// Position in entities_ while alive, otherwise the next slot in the free list.
+        uint32_t link_ = -1;
+    };
+
+    /// Number of slots in each page of the slot table.
+    static const uint32_t SlotPageSize = 1024;
+
+    inline EntitySlot& GetSlot(uint32_t index) { return slotPages_[index / SlotPageSize][index % SlotPageSize]; }
+
     /// Allocates an entity.
     Entity* AllocateEntity();
+    /// Allocates up to count entities of a definition without states and appends them to created.
+    void AllocateEntities(EntityDefinition* definition, size_t count, std::vector<Entity*>& created);
     void FillNewEntity(Entity* entity, EntityDefinition* definition);
-    void PromoteEntity(Entity* entity, EntityDefinition* fromDefinition, EntityDefinition* toDefinition);
+    /// Allocates and initializes the states of entities of one definition in contiguous ranges.
+    /// Publishes EET_Added once unless notify is false, the caller then publishes the entities itself.
+    void FillNewEntities(Entity* const* entities, size_t count, EntityDefinition* definition, bool notify = true);
+    /// Applies one round of commands taken out of the command buffers, along with the pending removals and additions.
+    void ApplyCommands(std::vector<CommandBuffer>& buffers);
+    /// Every command buffer that has been handed out, workers' slots first then the other threads' in first use order.
+    void GatherCommandBuffers(std::vector<CommandBuffer*>& buffers) const;
+    /// Promotes entities that all belong to fromDefinition.
+    void PromoteGroup(Entity* const* entities, size_t count, EntityDefinition* fromDefinition, EntityDefinition* toDefinition);
+    /// Releases the storage slot of an entity, fixing up the location of whichever entity was moved into the slot.
+    void ReleaseState(Entity* entity);
+    /// Creates the set for a sparse component type.
+    SparseSet* CreateSparseSet(CompID typeID, ComponentBase* component);
+    /// Returns the slot of a destroyed entity to the free list and retires its handle, along with any sparse states.
+    void ReleaseEntity(Entity* entity);
+
+    /// Work for one column of the target definition when promoting between two definitions.
+    struct PromotionStep
+    {
+        enum Operation
+        {
+            /// Bitwise copy of the source state.
+            Copy,
+            /// Batched ConvertState from the source state.
+            Convert,
+            /// Fresh state from the target definition's prototype or InitializeState.
+            Initialize,
+        };
+        Operation operation_;
+        /// Flat index of the column in the target definition.
+        uint32_t toColumn_;
+        /// Flat index of the column in the source definition, unused for Initialize.
+        uint32_t fromColumn_;
+    };
+    typedef std::vector<PromotionStep> PromotionPlan;
+
+    /// Retrieves the cached plan for promoting from one definition to another, building it on first use.
+    const PromotionPlan& GetPromotionPlan(EntityDefinition* fromDefinition, EntityDefinition* toDefinition);
+
+    /// Delivers an event to the observers and records it, entities are split into runs of the same definition.
+    void Publish(EntityEventType type, Entity* const* entities, size_t count);
 
     /// The simulation world
     SimWorld* world_ = 0x0;
-    /// Maps an entity handle to an actual index.
-    std::unordered_map<uint32_t, uint32_t> indirectionTable_;
-    /// Stores the entity instances, along with their handle index in the indirection table so that the the actual index can be updated.
-    std::vector< std::pair<Entity*, uint32_t> > entities_;
+    /// Pages of the slot table, indexed by EntityIndex(id) / SlotPageSize.
+    std::vector<EntitySlot*> slotPages_;
+    /// Number of slots that have ever been used.
+    uint32_t slotCount_ = 0;
+    /// Head of the list of released slots, -1 when empty.
+    uint32_t freeSlot_ = -1;
+    /// Slots released with their last generation, never handed out again.
+    uint32_t retiredSlots_ = 0;
+    /// Dense list of the live entities for iteration, each slot's link_ is its position here.
+    std::vector<Entity*> entities_;
+    /// Chunked struct-of-arrays state storage for each definition, indexed by DefID.
+    std::vector<EntityStorage*> storages_;
+    /// Sets of the sparse component types, indexed by CompID.
+    std::vector<SparseSet*> sparseSets_;
+    /// Promotion plans keyed by (fromDefID << 32 | toDefID).
+    std::unordered_map<uint64_t, PromotionPlan> promotionPlans_;
+    /// Scratch space for gathering source states of a batched conversion, aligned like the columns it is gathered from.
+    std::vector<unsigned char, AlignedAllocator<unsigned char> > conversionScratch_;
 
-    /// When execution is blocked entity creation results in queued construction.
+    /// When execution is blocked entity creation results in queued construction, only valid from the locking thread.
     std::vector<Entity*> pendingAddition_;
-    /// When execution is blocked entity removal results in queued destrution.
-    std::vector<Entity*> pendingRemoval_;
+    /// When execution is blocked entity removal results in queued destrution, only valid from the locking thread.
+    std::vector<EntityID> pendingRemoval_;
+    /// Command buffer of each JobSystem worker indexed by JobSystem::GetThreadIndex(), allocated on first use.
+    /// Slot 0 stays empty, index 0 is shared by every thread that isn't a worker.
+    std::vector<CommandBuffer*> commandBuffers_;
+    /// Command buffers of the threads that aren't workers, or whose index is past the table, keyed by thread id.
+    std::vector<std::pair<std::thread::id, CommandBuffer*> > threadBuffers_;
+    /// Guards threadBuffers_.
+    mutable std::mutex threadBuffersLock_;
 
-    typedef std::vector<Callback*> CallbackList;
-    CallbackList entityAdded_;
-    CallbackList entityRemoved_;
-    CallbackList entityPromoted_;
+    /// Observers notified of structural changes.
+    std::vector<EntityObserver*> observers_;
+    /// Events of each type since the last ClearEvents, only filled while recordEvents_ is set.
+    EntityEventStream events_[EET_Count];
+    /// If true then events are recorded to events_.
+    bool recordEvents_ = false;
 
-    /// End of the cache vector of entities, past this is either void space or entities waiting to be brought back into service.
-    size_t listTail_ = 0;
     /// If true then all creates and removes and not instant
     bool inExecution_ = false;
+    /// Change version counter, 0 is reserved to mean "since forever".
+    std::atomic<uint32_t> changeVersion_{ 1 };
 };
 
 END_PARSECS_NS
\ No newline at end of file
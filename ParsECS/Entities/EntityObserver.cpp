@@ -2,19 +2,23 @@
 
 #include "EntityManager.h"
 
-#include <functional>
-
 EntityObserver::~EntityObserver()
 {
-    for (unsigned i = 0; i < callbacks_.size(); ++i)
-        delete callbacks_[i];
+    Disconnect();
 }
 
 void EntityObserver::Connect(EntityManager* manager)
 {
+    Disconnect();
     if (!manager)
         return;
-    callbacks_.push_back(manager->SubscribeEntityAdded([=](Entity* e) { this->EntityAdded(e); }));
-    callbacks_.push_back(manager->SubscribeEntityRemoved([=](Entity* e) { this->EntityRemoved(e); }));
-    callbacks_.push_back(manager->SubscribeEntityPromoted([=](Entity* e) { this->EntityPromoted(e); }));
+    manager_ = manager;
+    manager_->AddObserver(this);
+}
+
+void EntityObserver::Disconnect()
+{
+    if (manager_)
+        manager_->RemoveObserver(this);
+    manager_ = 0x0;
 }
\ No newline at end of file
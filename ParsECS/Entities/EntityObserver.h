@@ -4,18 +4,27 @@
 
 struct Entity;
 
+/// Receives the structural changes of an EntityManager in bulk.
+/// Each notification covers entities of a single definition, for promotions that is the definition they moved into.
 class EntityObserver
 {
 public:
     EntityObserver() { }
     virtual ~EntityObserver();
 
+    /// Starts observing a manager, an observer watches one manager at a time.
     virtual void Connect(EntityManager* manager);
+    /// Stops observing.
+    void Disconnect();
+    /// Manager being observed, 0x0 if not connected.
+    EntityManager* GetManager() const { return manager_; }
 
-    virtual void EntityAdded(Entity*) = 0;
-    virtual void EntityRemoved(Entity*) = 0;
-    virtual void EntityPromoted(Entity*) = 0;
+    virtual void EntitiesAdded(DefID definition, const EntityID* ids, size_t count) = 0;
+    /// Removed entities are still alive during the notification.
+    virtual void EntitiesRemoved(DefID definition, const EntityID* ids, size_t count) = 0;
+    virtual void EntitiesPromoted(DefID definition, const EntityID* ids, size_t count) = 0;
 
 protected:
-    std::vector<EntityManager::Callback*> callbacks_;
+    friend class EntityManager;
+    EntityManager* manager_ = 0x0;
 };
\ No newline at end of file
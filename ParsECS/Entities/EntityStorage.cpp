@@ -0,0 +1,224 @@
+#include "EntityStorage.h"
+
+#include "../AlignedAllocator.h"
+#include "../Components/ComponentRegistry.h"
+#include "../MemoryAllocator.h"
+#include "../ThreadCachedMemory.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t ChunkHeaderSize = (sizeof(StorageChunk) + 15) & ~15u;
+
+void ChunkLayout::Build(const ComponentBits& mask)
+{
+    mask_ = mask;
+    columns_.clear();
+    std::fill(flatIndex_, flatIndex_ + PARSECS_COMPONENT_COUNT, (uint16_t)PARSECS_INVALID_FLAT_INDEX);
+    std::fill(columnOffset_, columnOffset_ + PARSECS_COMPONENT_COUNT, 0u);
+
+    uint32_t entitySize = sizeof(EntityID);
+    uint32_t padding = 0;
+    alignment_ = 16;
+    std::vector<uint32_t> alignments;
+    for (unsigned i = 0; i < mask.size(); ++i)
+    {
+        if (mask[i])
+        {
+            columns_.push_back({ i, (uint32_t)ComponentRegistry::GetDataSize(i), 0 });
+            alignments.push_back((uint32_t)ComponentRegistry::GetDataAlignment(i));
+            assert(alignments.back() <= PARSECS_MAX_STATE_ALIGNMENT && (alignments.back() & (alignments.back() - 1)) == 0);
+            entitySize += columns_.back().stateSize_;
+            padding += alignments.back() - 1;
+            alignment_ = std::max(alignment_, alignments.back());
+        }
+    }
+
+    // Changed and added version of each column sit between the header and the IDs
+    versionsOffset_ = ChunkHeaderSize;
+    const uint32_t headerSize = (versionsOffset_ + (uint32_t)columns_.size() * 2 * sizeof(uint32_t) + 15) & ~15u;
+
+    // Always fit at least one entity, even if that means exceeding the default chunk size.
+    // Padding in front of each column is at most its alignment less one, reserving that much always fits.
+    chunkSize_ = std::max<uint32_t>(PARSECS_CHUNK_SIZE, headerSize + entitySize + padding);
+    capacity_ = (chunkSize_ - headerSize - padding) / entitySize;
+
+    idsOffset_ = headerSize;
+    uint32_t offset = idsOffset_ + capacity_ * sizeof(EntityID);
+    for (size_t i = 0; i < columns_.size(); ++i)
+    {
+        auto& column = columns_[i];
+        column.offset_ = offset = (uint32_t)AlignUp(offset, alignments[i]);
+        offset += column.stateSize_ * capacity_;
+
+        flatIndex_[column.typeID_] = (uint16_t)i;
+        columnOffset_[column.typeID_] = column.offset_;
+    }
+}
+
+ComponentState* StorageChunk::GetState(CompID typeID, uint32_t index)
+{
+    const uint16_t flatIndex = layout_->flatIndex_[typeID];
+    if (flatIndex == PARSECS_INVALID_FLAT_INDEX)
+        return 0x0;
+    return (ComponentState*)((unsigned char*)this + layout_->columnOffset_[typeID] + layout_->columns_[flatIndex].stateSize_ * index);
+}
+
+void StorageChunk::MarkAllChanged(uint32_t version)
+{
+    uint32_t* changed = GetChangedVersions();
+    std::fill(changed, changed + layout_->columns_.size(), version);
+}
+
+void StorageChunk::MarkAllAdded(uint32_t version)
+{
+    // Changed and added arrays are adjacent
+    uint32_t* versions = GetChangedVersions();
+    std::fill(versions, versions + layout_->columns_.size() * 2, version);
+}
+
+EntityStorage::EntityStorage(DefID defID, const ChunkLayout* layout, MemoryMan* memory, const std::atomic<uint32_t>* changeVersion, ThreadCachedMemory* cache) :
+    defID_(defID),
+    layout_(layout),
+    memory_(memory),
+    cache_(cache),
+    changeVersion_(changeVersion)
+{
+    assert(!cache_ || cache_->GetCentral() == memory_);
+}
+
+EntityStorage::~EntityStorage()
+{
+    for (auto chunk : chunks_)
+        FreeChunkMemory(chunk);
+    chunks_.clear();
+}
+
+StorageChunk* EntityStorage::Allocate(EntityID id, uint32_t& index)
+{
+    StorageChunk* chunk = chunks_.empty() ? 0x0 : chunks_.back();
+    if (!chunk || chunk->count_ == layout_->capacity_)
+        chunk = AddChunk();
+    if (!chunk)
+        return 0x0;
+
+    index = chunk->count_++;
+    chunk->GetIDs()[index] = id;
+    chunk->MarkAllChanged(changeVersion_->load(std::memory_order_relaxed));
+    ++entityCount_;
+    return chunk;
+}
+
+StorageChunk* EntityStorage::AllocateRange(const EntityID* ids, uint32_t count, uint32_t& index, uint32_t& allocated)
+{
+    StorageChunk* chunk = chunks_.empty() ? 0x0 : chunks_.back();
+    if (!chunk || chunk->count_ == layout_->capacity_)
+        chunk = AddChunk();
+    if (!chunk)
+    {
+        allocated = 0;
+        return 0x0;
+    }
+
+    index = chunk->count_;
+    allocated = std::min(count, layout_->capacity_ - chunk->count_);
+    memcpy(chunk->GetIDs() + index, ids, allocated * sizeof(EntityID));
+    chunk->count_ += allocated;
+    chunk->MarkAllChanged(changeVersion_->load(std::memory_order_relaxed));
+    entityCount_ += allocated;
+    return chunk;
+}
+
+EntityID EntityStorage::Free(StorageChunk* chunk, uint32_t index)
+{
+    assert(chunk && chunk->storage_ == this && index < chunk->count_);
+
+    StorageChunk* last = chunks_.back();
+    const uint32_t lastIndex = last->count_ - 1;
+
+    EntityID moved = -1;
+    if (last != chunk || lastIndex != index)
+    {
+        // Move the final entity into the hole, column by column
+        for (size_t i = 0; i < layout_->columns_.size(); ++i)
+        {
+            const uint32_t stride = layout_->columns_[i].stateSize_;
+            memcpy((unsigned char*)chunk->GetColumn(i) + stride * index, (unsigned char*)last->GetColumn(i) + stride * lastIndex, stride);
+        }
+        moved = chunk->GetIDs()[index] = last->GetIDs()[lastIndex];
+        chunk->MarkAllChanged(changeVersion_->load(std::memory_order_relaxed));
+    }
+
+    --last->count_;
+    --entityCount_;
+    if (last->count_ == 0)
+    {
+        chunks_.pop_back();
+        FreeChunkMemory(last);
+    }
+    return moved;
+}
+
+void EntityStorage::SwapSlots(StorageChunk* chunkA, uint32_t indexA, StorageChunk* chunkB, uint32_t indexB)
+{
+    assert(chunkA->storage_ == this && chunkB->storage_ == this && indexA < chunkA->count_ && indexB < chunkB->count_);
+    if (chunkA == chunkB && indexA == indexB)
+        return;
+
+    for (size_t i = 0; i < layout_->columns_.size(); ++i)
+    {
+        const uint32_t stride = layout_->columns_[i].stateSize_;
+        unsigned char* stateA = (unsigned char*)chunkA->GetColumn(i) + stride * indexA;
+        std::swap_ranges(stateA, stateA + stride, (unsigned char*)chunkB->GetColumn(i) + stride * indexB);
+    }
+    std::swap(chunkA->GetIDs()[indexA], chunkB->GetIDs()[indexB]);
+
+    const uint32_t version = changeVersion_->load(std::memory_order_relaxed);
+    chunkA->MarkAllChanged(version);
+    chunkB->MarkAllChanged(version);
+}
+
+StorageChunk* EntityStorage::RelocateChunk(size_t index)
+{
+    StorageChunk* chunk = chunks_[index];
+    StorageChunk* moved = AllocateChunkMemory();
+    if (!moved)
+        return 0x0;
+
+    // States are plain data, the header moves along with them
+    memcpy(moved, chunk, layout_->chunkSize_);
+    chunks_[index] = moved;
+    FreeChunkMemory(chunk);
+    return moved;
+}
+
+StorageChunk* EntityStorage::AddChunk()
+{
+    StorageChunk* chunk = AllocateChunkMemory();
+    assert(chunk);
+    if (!chunk)
+        return 0x0;
+
+    chunk->storage_ = this;
+    chunk->layout_ = layout_;
+    chunk->count_ = 0;
+    chunk->index_ = (uint32_t)chunks_.size();
+    chunk->MarkAllAdded(changeVersion_->load(std::memory_order_relaxed));
+    chunks_.push_back(chunk);
+    return chunk;
+}
+
+StorageChunk* EntityStorage::AllocateChunkMemory()
+{
+    if (cache_)
+        return (StorageChunk*)cache_->Allocate(layout_->chunkSize_, layout_->alignment_);
+    return (StorageChunk*)memory_->Allocate(layout_->chunkSize_, layout_->alignment_);
+}
+
+void EntityStorage::FreeChunkMemory(StorageChunk* chunk)
+{
+    if (cache_)
+        cache_->Free(chunk);
+    else
+        memory_->Free(chunk);
+}
\ No newline at end of file
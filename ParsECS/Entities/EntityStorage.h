@@ -0,0 +1,191 @@
+#pragma once
+
+#include "../ParsecDef.h"
+#include "../ComponentCount.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct ComponentState;
+struct MemoryMan;
+class EntityStorage;
+class ThreadCachedMemory;
+
+/// Default size of a storage chunk, definitions whose single entity does not fit will use larger chunks.
+#define PARSECS_CHUNK_SIZE (16 * 1024)
+/// Value of ChunkLayout::flatIndex_ for component types that are not part of the layout.
+#define PARSECS_INVALID_FLAT_INDEX 0xFFFF
+
+/// Describes where the states of one component type live within a storage chunk.
+struct StorageColumn
+{
+    /// Component type stored in this column.
+    CompID typeID_;
+    /// sizeof the component State, this is the stride between entities in the column.
+    uint32_t stateSize_;
+    /// Byte offset of the first state from the start of the chunk.
+    uint32_t offset_;
+};
+
+/// Returns true if a change version is at or after since, a since of 0 accepts everything. Safe across wrap around.
+/// Inclusive so that writes stamped while a system was running are seen by its next run, at worst a chunk is revisited.
+inline bool ChangedSince(uint32_t version, uint32_t since)
+{
+    return since == 0 || (int32_t)(version - since) >= 0;
+}
+
+/// Struct-of-arrays layout of a chunk, calculated once when an EntityDefinition is sealed.
+/// A chunk is laid out as [StorageChunk header][changed versions][added versions][EntityID x capacity][column 0 x capacity]...
+/// Each column starts at a multiple of its type's alignment, so its states are aligned as long as the chunk is.
+struct ChunkLayout
+{
+    /// Total bytes of a chunk.
+    uint32_t chunkSize_ = 0;
+    /// Alignment chunks must be allocated at, the strictest column alignment and at least 16.
+    uint32_t alignment_ = 16;
+    /// Number of entities that fit into a single chunk.
+    uint32_t capacity_ = 0;
+    /// Byte offset of the per-column version arrays from the start of the chunk.
+    uint32_t versionsOffset_ = 0;
+    /// Byte offset of the EntityID array from the start of the chunk.
+    uint32_t idsOffset_ = 0;
+    /// Components stored in the chunks, the definition's mask.
+    ComponentBits mask_;
+    /// Columns in flat index order (ascending component bit).
+    std::vector<StorageColumn> columns_;
+    /// Flat index of each component type, PARSECS_INVALID_FLAT_INDEX if the type is absent.
+    uint16_t flatIndex_[PARSECS_COMPONENT_COUNT];
+    /// Byte offset of each component type's column from the start of the chunk, 0 if the type is absent.
+    uint32_t columnOffset_[PARSECS_COMPONENT_COUNT];
+
+    /// Calculate the layout for the given component mask.
+    void Build(const ComponentBits& mask);
+};
+
+/// Header of a fixed size block that holds the states of up to ChunkLayout::capacity_ entities of the same definition.
+struct StorageChunk
+{
+    /// Storage that owns this chunk.
+    EntityStorage* storage_;
+    /// Layout of the owning storage's definition.
+    const ChunkLayout* layout_;
+    /// Number of live entities in this chunk, they are always packed at the front.
+    uint32_t count_;
+    /// Position of this chunk in the owning storage.
+    uint32_t index_;
+
+    /// Entity handles, parallel to the columns.
+    inline EntityID* GetIDs() { return (EntityID*)((unsigned char*)this + layout_->idsOffset_); }
+    /// Start of the state array for the column at the given flat index.
+    inline ComponentState* GetColumn(size_t flatIndex) { return (ComponentState*)((unsigned char*)this + layout_->columns_[flatIndex].offset_); }
+    /// Start of the state array for the given component type, 0x0 if the type is not stored here.
+    inline ComponentState* GetColumnByType(CompID typeID)
+    {
+        if (layout_->flatIndex_[typeID] == PARSECS_INVALID_FLAT_INDEX)
+            return 0x0;
+        return (ComponentState*)((unsigned char*)this + layout_->columnOffset_[typeID]);
+    }
+    /// Address of the state for a component type of an entity in this chunk.
+    ComponentState* GetState(CompID typeID, uint32_t index);
+
+    /// Change version each column was last written at, in flat index order.
+    inline uint32_t* GetChangedVersions() { return (uint32_t*)((unsigned char*)this + layout_->versionsOffset_); }
+    /// Change version states were last added to each column at, in flat index order.
+    inline uint32_t* GetAddedVersions() { return GetChangedVersions() + layout_->columns_.size(); }
+    /// Stamps the column of a component type as written. Views stamp their Write terms, code that writes
+    /// through raw column pointers or Entity::GetComponentState should stamp the chunks it modifies.
+    inline void MarkChanged(CompID typeID, uint32_t version)
+    {
+        const uint16_t flatIndex = layout_->flatIndex_[typeID];
+        if (flatIndex != PARSECS_INVALID_FLAT_INDEX)
+            GetChangedVersions()[flatIndex] = version;
+    }
+    /// Stamps every column as written.
+    void MarkAllChanged(uint32_t version);
+    /// Stamps the column at a flat index as having new states, which is also a change.
+    inline void MarkAdded(size_t flatIndex, uint32_t version) { GetChangedVersions()[flatIndex] = GetAddedVersions()[flatIndex] = version; }
+    /// Stamps every column as having new states.
+    void MarkAllAdded(uint32_t version);
+
+    /// Typed access to a column, T is the Component type.
+    template<typename T>
+    typename T::State* GetStates() { return (typename T::State*)GetColumnByType(T::TypeID); }
+};
+
+/// Run of entities [begin_, end_) of a single chunk, the unit of work for parallel iteration.
+/// All entities of a range share a definition and their states are contiguous in each column.
+struct QueryRange
+{
+    StorageChunk* chunk_;
+    uint32_t begin_;
+    uint32_t end_;
+};
+
+/// Chunked struct-of-arrays storage of all entity states for a single EntityDefinition.
+/// Entities are kept densely packed, removal moves the last entity into the vacated slot.
+/// States are moved bitwise and released without destruction, EntityDefinition::Seal only admits trivially copyable ones.
+class EntityStorage
+{
+public:
+    /// Construct for a definition, chunks are allocated from the given memory manager, through cache if one is given.
+    /// The cache must trade with memory and outlive the storage.
+    /// Slot changes are stamped with the value of changeVersion, the owning manager's counter.
+    EntityStorage(DefID defID, const ChunkLayout* layout, MemoryMan* memory, const std::atomic<uint32_t>* changeVersion, ThreadCachedMemory* cache = 0x0);
+    /// Destruct and release all chunks.
+    ~EntityStorage();
+
+    /// Reserves a slot at the end of the storage for the given entity, the states are not initialized.
+    /// Allocation and Free stamp the affected chunks as changed, marking states as added is left to the caller.
+    StorageChunk* Allocate(EntityID id, uint32_t& index);
+    /// Reserves contiguous slots for as many of the given entities as fit into the last chunk, adding a chunk if it is full.
+    /// Returns the chunk, with index set to the first slot and allocated to the number of slots reserved.
+    StorageChunk* AllocateRange(const EntityID* ids, uint32_t count, uint32_t& index, uint32_t& allocated);
+    /// Releases the slot of an entity, the last entity in the storage is moved into the vacated slot.
+    /// Returns the ID of the moved entity so that its location can be updated, or -1 if nothing moved.
+    EntityID Free(StorageChunk* chunk, uint32_t index);
+    /// Exchanges the states and IDs of two slots and stamps both chunks as changed.
+    /// The caller updates the locations of the two entities.
+    void SwapSlots(StorageChunk* chunkA, uint32_t indexA, StorageChunk* chunkB, uint32_t indexB);
+    /// Copies a chunk into a fresh block of the memory manager and frees the old one, the chunk keeps its position.
+    /// Returns the new chunk, or 0x0 if no memory was available. The caller updates the locations of its entities.
+    StorageChunk* RelocateChunk(size_t index);
+
+    /// The definition whose entities are stored.
+    DefID GetDefinitionID() const { return defID_; }
+    /// Layout used by all chunks.
+    const ChunkLayout* GetLayout() const { return layout_; }
+    /// Number of chunks, all chunks except the last are full.
+    size_t GetChunkCount() const { return chunks_.size(); }
+    /// Retrieve a chunk by index.
+    StorageChunk* GetChunk(size_t index) const { return chunks_[index]; }
+    /// Total number of entities stored.
+    size_t GetEntityCount() const { return entityCount_; }
+    /// Source of chunk memory.
+    MemoryMan* GetMemory() const { return memory_; }
+    /// Per thread cache in front of the memory manager, 0x0 if chunks come from it directly.
+    ThreadCachedMemory* GetCache() const { return cache_; }
+
+private:
+    /// Allocates a fresh empty chunk at the end of the chunk list.
+    StorageChunk* AddChunk();
+    /// Obtains the memory of a chunk, from the cache if there is one.
+    StorageChunk* AllocateChunkMemory();
+    /// Returns the memory of a chunk to where it came from.
+    void FreeChunkMemory(StorageChunk* chunk);
+
+    /// Definition that this storage is for.
+    DefID defID_;
+    /// Layout of the chunks.
+    const ChunkLayout* layout_;
+    /// Source of chunk memory.
+    MemoryMan* memory_;
+    /// Optional per thread cache in front of memory_.
+    ThreadCachedMemory* cache_;
+    /// Change version counter of the owning manager.
+    const std::atomic<uint32_t>* changeVersion_;
+    /// Chunks in order, only the last chunk may be partially filled.
+    std::vector<StorageChunk*> chunks_;
+    /// Total count of entities.
+    size_t entityCount_ = 0;
+};
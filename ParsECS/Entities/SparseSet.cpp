@@ -0,0 +1,90 @@
+#include "SparseSet.h"
+
+#include "../Components/Component.h"
+
+#include <cstring>
+
+SparseSet::SparseSet(CompID typeID, ComponentBase* component) :
+    typeID_(typeID),
+    component_(component),
+    stateSize_(component->StateSize())
+{
+}
+
+SparseSet::~SparseSet()
+{
+    for (auto page : pages_)
+        delete[] page;
+    pages_.clear();
+    delete component_;
+}
+
+uint32_t SparseSet::DenseIndex(EntityID id) const
+{
+    const uint32_t index = EntityIndex(id);
+    const uint32_t page = index / PageSize;
+    if (page >= pages_.size() || !pages_[page])
+        return -1;
+
+    // The handle check rejects stale IDs whose slot was reused by another entity
+    const uint32_t dense = pages_[page][index % PageSize];
+    if (dense != (uint32_t)-1 && ids_[dense] == id)
+        return dense;
+    return -1;
+}
+
+ComponentState* SparseSet::Add(EntityID id)
+{
+    uint32_t dense = DenseIndex(id);
+    if (dense != (uint32_t)-1)
+        return (ComponentState*)(states_.data() + dense * stateSize_);
+
+    const uint32_t index = EntityIndex(id);
+    const uint32_t page = index / PageSize;
+    if (page >= pages_.size())
+        pages_.resize(page + 1, 0x0);
+    if (!pages_[page])
+    {
+        pages_[page] = new uint32_t[PageSize];
+        memset(pages_[page], 0xFF, PageSize * sizeof(uint32_t));
+    }
+
+    dense = (uint32_t)ids_.size();
+    pages_[page][index % PageSize] = dense;
+    ids_.push_back(id);
+    states_.resize(states_.size() + stateSize_);
+
+    void* state = states_.data() + dense * stateSize_;
+    component_->_InitializeState(state);
+    return (ComponentState*)state;
+}
+
+bool SparseSet::Remove(EntityID id)
+{
+    const uint32_t dense = DenseIndex(id);
+    if (dense == (uint32_t)-1)
+        return false;
+
+    // Move the last state into the hole
+    const uint32_t last = (uint32_t)ids_.size() - 1;
+    if (dense != last)
+    {
+        memcpy(states_.data() + dense * stateSize_, states_.data() + last * stateSize_, stateSize_);
+        ids_[dense] = ids_[last];
+        const uint32_t movedIndex = EntityIndex(ids_[dense]);
+        pages_[movedIndex / PageSize][movedIndex % PageSize] = dense;
+    }
+
+    pages_[EntityIndex(id) / PageSize][EntityIndex(id) % PageSize] = -1;
+    ids_.pop_back();
+    states_.resize(states_.size() - stateSize_);
+    return true;
+}
+
+ComponentState* SparseSet::Get(EntityID id)
+{
+    const uint32_t dense = DenseIndex(id);
+    if (dense == (uint32_t)-1)
+        return 0x0;
+    return (ComponentState*)(states_.data() + dense * stateSize_);
+}
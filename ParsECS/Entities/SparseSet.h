@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../ParsecDef.h"
+#include "../AlignedAllocator.h"
+
+#include <cstdint>
+#include <vector>
+
+struct ComponentBase;
+struct ComponentState;
+
+/// Storage for the states of one sparse component type, kept outside of the definition's chunks.
+/// States are packed densely in insertion order, a paged table maps the entity index to the dense position.
+/// Adding and removing are O(1), removal moves the last state into the vacated position.
+/// States are moved with memcpy and dropped without destruction, only trivially copyable states may be stored.
+class SparseSet
+{
+public:
+    /// Construct for a component type, the set takes ownership of the component which initializes new states.
+    SparseSet(CompID typeID, ComponentBase* component);
+    /// Destruct and release the component.
+    ~SparseSet();
+
+    /// Adds an initialized state for the entity, returns the existing state if it already has one.
+    /// Pointers to states are invalidated by subsequent adds.
+    ComponentState* Add(EntityID id);
+    /// Removes the entity's state, returns false if it had none.
+    bool Remove(EntityID id);
+    /// Retrieves the entity's state, 0x0 if it has none.
+    ComponentState* Get(EntityID id);
+    /// Returns true if the entity has a state in this set.
+    bool Contains(EntityID id) const { return DenseIndex(id) != (uint32_t)-1; }
+
+    /// Component type stored.
+    CompID GetTypeID() const { return typeID_; }
+    /// Component used to initialize the states.
+    ComponentBase* GetComponent() const { return component_; }
+    /// Number of states stored.
+    size_t GetSize() const { return ids_.size(); }
+    /// Entity handles, parallel to the states.
+    const EntityID* GetIDs() const { return ids_.data(); }
+    /// Start of the dense state array.
+    ComponentState* GetStates() { return (ComponentState*)states_.data(); }
+    /// Bytes between consecutive states.
+    size_t GetStateSize() const { return stateSize_; }
+
+    /// Typed access to the dense state array, T is the Component type.
+    template<typename T>
+    typename T::State* GetStates() { return (typename T::State*)states_.data(); }
+
+private:
+    /// Number of entries in each page of the sparse table.
+    static const uint32_t PageSize = 1024;
+
+    /// Dense position of the entity's state, -1 if it has none.
+    uint32_t DenseIndex(EntityID id) const;
+
+    /// Component type stored.
+    CompID typeID_;
+    /// Component that initializes states.
+    ComponentBase* component_;
+    /// sizeof the component State.
+    size_t stateSize_;
+    /// Pages of dense positions indexed by EntityIndex(id), pages are allocated on first use.
+    std::vector<uint32_t*> pages_;
+    /// Handles in dense order.
+    std::vector<EntityID> ids_;
+    /// States in dense order, aligned for any state type.
+    std::vector<unsigned char, AlignedAllocator<unsigned char> > states_;
+};
@@ -0,0 +1,219 @@
+#include "EntityCompactor.h"
+
+#include "ConcernedList.h"
+#include "MemoryAllocator.h"
+#include "SimWorld.h"
+#include "ThreadCachedMemory.h"
+#include "Entities/EntityManager.h"
+#include "Entities/EntityStorage.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+/// Chunks checked in one relocate step when none of them has to move.
+static const size_t RelocateScanLimit = 64;
+
+EntityCompactor::EntityCompactor(EntityManager* manager) :
+    manager_(manager)
+{
+    assert(manager_);
+}
+
+EntityCompactor::~EntityCompactor()
+{
+    if (phase_ == CP_Relocate)
+        EndRelocate();
+}
+
+MemoryMan* EntityCompactor::GetMemory() const
+{
+    return manager_->GetWorld() ? manager_->GetWorld()->GetMemoryManager() : 0x0;
+}
+
+void EntityCompactor::FlushThreadCache() const
+{
+    if (ThreadCachedMemory* cache = manager_->GetWorld() ? manager_->GetWorld()->GetThreadCachedMemory() : 0x0)
+        cache->FlushThread();
+}
+
+bool EntityCompactor::Step(uint32_t microseconds)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(microseconds);
+
+    do
+    {
+        switch (phase_)
+        {
+        case CP_Order:
+            if (!StepOrder())
+            {
+                target_.clear();
+                ordering_ = false;
+                storage_ = 0;
+                BeginRelocate();
+                phase_ = CP_Relocate;
+            }
+            break;
+
+        case CP_Relocate:
+            if (!StepRelocate())
+            {
+                EndRelocate();
+                phase_ = CP_Release;
+            }
+            break;
+
+        case CP_Release:
+            if (MemoryMan* memory = GetMemory())
+                memory->ReleaseEmptyPages(keepEmptyPages_);
+            storage_ = 0;
+            phase_ = CP_Order;
+            ++passCount_;
+            return true;
+        }
+    } while (Clock::now() < deadline);
+    return false;
+}
+
+bool EntityCompactor::StepOrder()
+{
+    if (!order_)
+        return false;
+
+    if (!ordering_)
+    {
+        // Group by definition once per pass, each storage then finds its entities by binary search
+        target_.clear();
+        target_.reserve(order_->size());
+        for (const ConcernedEntity& rec : *order_)
+            target_.push_back(std::make_pair(rec.defID_, rec.entityID_));
+        std::stable_sort(target_.begin(), target_.end(), [](const std::pair<DefID, EntityID>& lhs, const std::pair<DefID, EntityID>& rhs) { return lhs.first < rhs.first; });
+        ordering_ = true;
+        begun_ = false;
+    }
+
+    const std::vector<EntityStorage*>& storages = manager_->GetStorages();
+    while (storage_ < storages.size())
+    {
+        EntityStorage* storage = storages[storage_];
+        if (storage && !begun_)
+        {
+            const DefID defID = storage->GetDefinitionID();
+            targetIndex_ = std::lower_bound(target_.begin(), target_.end(), defID, [](const std::pair<DefID, EntityID>& entry, DefID id) { return entry.first < id; }) - target_.begin();
+            targetEnd_ = std::upper_bound(target_.begin(), target_.end(), defID, [](DefID id, const std::pair<DefID, EntityID>& entry) { return id < entry.first; }) - target_.begin();
+            position_ = 0;
+            begun_ = true;
+        }
+        if (!storage || targetIndex_ >= targetEnd_ || position_ >= storage->GetEntityCount())
+        {
+            ++storage_;
+            begun_ = false;
+            continue;
+        }
+
+        // Swap each listed entity into the next slot, whatever sat there takes the listed entity's old slot
+        const uint32_t capacity = storage->GetLayout()->capacity_;
+        const size_t stop = std::min(position_ + capacity, storage->GetEntityCount());
+        while (targetIndex_ < targetEnd_ && position_ < stop)
+        {
+            Entity* entity = manager_->GetEntity(target_[targetIndex_++].second);
+            if (!entity || !entity->chunk_ || entity->chunk_->storage_ != storage)
+                continue;
+            const size_t current = (size_t)entity->chunk_->index_ * capacity + entity->chunkIndex_;
+            if (current < position_)
+                continue;
+
+            if (current != position_)
+            {
+                StorageChunk* chunk = storage->GetChunk(position_ / capacity);
+                const uint32_t index = (uint32_t)(position_ % capacity);
+                Entity* displaced = manager_->GetEntity(chunk->GetIDs()[index]);
+                assert(displaced);
+
+                storage->SwapSlots(chunk, index, entity->chunk_, entity->chunkIndex_);
+                displaced->chunk_ = entity->chunk_;
+                displaced->chunkIndex_ = entity->chunkIndex_;
+                entity->chunk_ = chunk;
+                entity->chunkIndex_ = index;
+            }
+            ++position_;
+        }
+        return true;
+    }
+    return false;
+}
+
+void EntityCompactor::BeginRelocate()
+{
+    storage_ = 0;
+    chunk_ = 0;
+    MemoryMan* memory = GetMemory();
+    if (!memory || sparseThreshold_ <= 0.0f)
+        return;
+
+    // Blocks cached by this thread would be handed back out without consulting the pages, return them first
+    FlushThreadCache();
+
+    std::vector<MemoryPage*> sparse;
+    for (auto page = memory->pages_.head(); page; page = memory->pages_.next(page))
+    {
+        if (page->address_ && page->usedBytes_ > 0 && page->usedBytes_ < sparseThreshold_ * page->pageSize_)
+            sparse.push_back(page);
+    }
+
+    // Draining every sparse page would only move the chunks into new pages
+    std::sort(sparse.begin(), sparse.end(), [](const MemoryPage* lhs, const MemoryPage* rhs) { return lhs->usedBytes_ < rhs->usedBytes_; });
+    for (size_t i = 0; i < sparse.size() / 2; ++i)
+        memory->BeginDrain(sparse[i]);
+}
+
+void EntityCompactor::EndRelocate()
+{
+    // The blocks vacated by relocation sit in this thread's cache, the drained pages only empty once they are returned
+    FlushThreadCache();
+    if (MemoryMan* memory = GetMemory())
+    {
+        for (auto page = memory->pages_.head(); page; page = memory->pages_.next(page))
+            memory->EndDrain(page);
+    }
+    storage_ = 0;
+    chunk_ = 0;
+}
+
+bool EntityCompactor::StepRelocate()
+{
+    MemoryMan* memory = GetMemory();
+    if (!memory || sparseThreshold_ <= 0.0f)
+        return false;
+
+    const std::vector<EntityStorage*>& storages = manager_->GetStorages();
+    size_t scanned = 0;
+    while (storage_ < storages.size())
+    {
+        EntityStorage* storage = storages[storage_];
+        if (!storage || chunk_ >= storage->GetChunkCount())
+        {
+            ++storage_;
+            chunk_ = 0;
+            continue;
+        }
+
+        const size_t index = chunk_++;
+        MemoryPage* page = memory->FindPage(storage->GetChunk(index));
+        if (page && page->draining_)
+        {
+            if (StorageChunk* moved = storage->RelocateChunk(index))
+            {
+                const EntityID* ids = moved->GetIDs();
+                for (uint32_t i = 0; i < moved->count_; ++i)
+                    manager_->GetEntity(ids[i])->chunk_ = moved;
+            }
+            return true;
+        }
+        if (++scanned == RelocateScanLimit)
+            return true;
+    }
+    return false;
+}
\ No newline at end of file
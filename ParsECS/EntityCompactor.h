@@ -0,0 +1,82 @@
+#pragma once
+
+#include "ParsecDef.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class ConcernedList;
+class EntityManager;
+struct MemoryMan;
+
+/// Incrementally repairs what long create/destroy churn does to entity state memory, run in small time slices
+/// between frames while nothing iterates or changes the entities. A pass has three phases:
+/// - Order: storages are permuted so the entities of the ordering list come first and in list order, iterating the list then walks memory sequentially.
+/// - Relocate: chunks in sparsely used memory pages are moved into fuller pages so the sparse ones empty.
+/// - Release: empty pages beyond a reserve are returned to the OS.
+/// Entities created, destroyed or promoted between slices are picked up as they are found.
+class EntityCompactor
+{
+public:
+    /// Construct for a manager, chunk memory is the manager's world's memory manager.
+    EntityCompactor(EntityManager* manager);
+    /// Lets pages drained by an unfinished pass take allocations again.
+    ~EntityCompactor();
+
+    /// List whose order the storages follow, 0x0 skips the order phase. The list must stay alive while set.
+    void SetOrder(const ConcernedList* list) { order_ = list; }
+    /// Pages used below this fraction are candidates for draining, 0 skips the relocate phase.
+    void SetSparseThreshold(float fraction) { sparseThreshold_ = fraction; }
+    /// Number of empty pages kept for reuse instead of being released.
+    void SetKeepEmptyPages(size_t count) { keepEmptyPages_ = count; }
+
+    /// Works for about the given time, at least one step is always taken. Returns true if a pass completed.
+    bool Step(uint32_t microseconds);
+    /// Number of completed passes.
+    uint64_t GetPassCount() const { return passCount_; }
+
+private:
+    enum Phase
+    {
+        CP_Order,
+        CP_Relocate,
+        CP_Release,
+    };
+
+    /// Places up to a chunk's worth of the ordering list's entities, returns false once every storage is ordered.
+    bool StepOrder();
+    /// Moves one chunk out of a draining page, returns false once every chunk was checked.
+    bool StepRelocate();
+    /// Drains the emptier half of the sparse pages, the other half takes their chunks.
+    void BeginRelocate();
+    /// Lets every page take allocations again.
+    void EndRelocate();
+    /// Memory manager of the chunks, 0x0 if the world has none.
+    MemoryMan* GetMemory() const;
+    /// Returns the chunk blocks cached by the calling thread to the memory manager, if the world uses a cache.
+    void FlushThreadCache() const;
+
+    EntityManager* manager_;
+    const ConcernedList* order_ = 0x0;
+    float sparseThreshold_ = 0.5f;
+    size_t keepEmptyPages_ = 1;
+
+    Phase phase_ = CP_Order;
+    /// Storage being worked on, indexed by DefID.
+    size_t storage_ = 0;
+    /// Order: (DefID, EntityID) of the list's entities grouped by definition, captured at the start of the pass.
+    std::vector<std::pair<DefID, EntityID>> target_;
+    /// Order: set once target_ is captured.
+    bool ordering_ = false;
+    /// Order: range of target_ left for the current storage, begun_ is set once the range is found.
+    size_t targetIndex_ = 0;
+    size_t targetEnd_ = 0;
+    bool begun_ = false;
+    /// Order: slot the next target entity is placed into.
+    size_t position_ = 0;
+    /// Relocate: next chunk of the current storage to check.
+    size_t chunk_ = 0;
+    uint64_t passCount_ = 0;
+};
\ No newline at end of file
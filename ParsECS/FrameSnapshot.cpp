@@ -0,0 +1,110 @@
+#include "FrameSnapshot.h"
+
+#include "Entities/EntityManager.h"
+#include "Entities/EntityStorage.h"
+#include "../SysHub/JobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/// Arrays in the snapshot start on cache line boundaries, which suits any state alignment.
+static inline size_t AlignArray(size_t offset)
+{
+    return AlignUp(offset, PARSECS_MAX_STATE_ALIGNMENT);
+}
+
+FrameSnapshot::~FrameSnapshot()
+{
+    AlignedFree(data_);
+}
+
+void FrameSnapshot::Reserve(size_t size)
+{
+    if (size <= dataCapacity_)
+        return;
+
+    // Grown with headroom so that a slowly growing world doesn't reallocate every frame
+    const size_t capacity = std::max(size, dataCapacity_ + dataCapacity_ / 2);
+    AlignedFree(data_);
+    data_ = (unsigned char*)AlignedAllocate(capacity, PARSECS_MAX_STATE_ALIGNMENT);
+    assert(data_);
+    dataCapacity_ = data_ ? capacity : 0;
+}
+
+void FrameSnapshot::Extract(EntityManager* manager, const ComponentBits& mask, uint64_t frame, JobSystem* jobs)
+{
+    Clear();
+    frame_ = frame;
+
+    // Lay out the blocks first so that the chunks can be copied independently
+    struct ChunkCopy
+    {
+        StorageChunk* chunk_;
+        size_t block_;
+        uint32_t first_;
+    };
+    std::vector<ChunkCopy> copies;
+    size_t size = 0;
+    for (EntityStorage* storage : manager->GetStorages())
+    {
+        if (!storage || !storage->GetEntityCount() || !storage->GetLayout()->mask_.Intersects(mask))
+            continue;
+
+        const ChunkLayout* layout = storage->GetLayout();
+        SnapshotBlock block;
+        block.defID_ = storage->GetDefinitionID();
+        block.count_ = (uint32_t)storage->GetEntityCount();
+        block.idsOffset_ = size;
+        size = AlignArray(size + block.count_ * sizeof(EntityID));
+        for (auto& column : layout->columns_)
+        {
+            if (!mask.test(column.typeID_))
+                continue;
+            block.columns_.push_back({ column.typeID_, column.stateSize_, size });
+            size = AlignArray(size + (size_t)block.count_ * column.stateSize_);
+        }
+
+        // Every chunk but the last is full, so a chunk's entities start at its index times the capacity
+        for (size_t c = 0; c < storage->GetChunkCount(); ++c)
+            copies.push_back({ storage->GetChunk(c), blocks_.size(), (uint32_t)c * layout->capacity_ });
+        entityCount_ += block.count_;
+        blocks_.push_back(block);
+    }
+    // Every byte that is read is overwritten by a copy, so the buffer isn't cleared first
+    Reserve(size);
+    dataSize_ = size;
+
+    auto copyChunks = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            StorageChunk* chunk = copies[i].chunk_;
+            const SnapshotBlock& block = blocks_[copies[i].block_];
+            const uint32_t first = copies[i].first_;
+            memcpy(data_ + block.idsOffset_ + first * sizeof(EntityID), chunk->GetIDs(), chunk->count_ * sizeof(EntityID));
+            for (auto& column : block.columns_)
+                memcpy(data_ + column.offset_ + (size_t)first * column.stateSize_, chunk->GetColumnByType(column.typeID_), (size_t)chunk->count_ * column.stateSize_);
+        }
+    };
+    if (jobs)
+        jobs->ParallelFor(0, copies.size(), 0, copyChunks);
+    else
+        copyChunks(0, copies.size());
+}
+
+void FrameSnapshot::Clear()
+{
+    dataSize_ = 0;
+    blocks_.clear();
+    entityCount_ = 0;
+}
+
+const void* FrameSnapshot::GetStates(const SnapshotBlock& block, CompID typeID) const
+{
+    for (auto& column : block.columns_)
+    {
+        if (column.typeID_ == typeID)
+            return data_ + column.offset_;
+    }
+    return 0x0;
+}
\ No newline at end of file
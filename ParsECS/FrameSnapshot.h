@@ -0,0 +1,85 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "ComponentCount.h"
+#include "ParsecDef.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class EntityManager;
+class JobSystem;
+
+/// Extracted states of one component type within a SnapshotBlock.
+struct SnapshotColumn
+{
+    CompID typeID_;
+    uint32_t stateSize_;
+    /// Byte offset of the first state in the snapshot's data.
+    size_t offset_;
+};
+
+/// Entities of one definition in a snapshot, the IDs and every column are contiguous arrays of count_ entries.
+struct SnapshotBlock
+{
+    DefID defID_;
+    uint32_t count_;
+    /// Byte offset of the IDs in the snapshot's data.
+    size_t idsOffset_;
+    /// Extracted columns of the definition.
+    std::vector<SnapshotColumn> columns_;
+};
+
+/// Read-only copy of selected component columns taken between simulation frames, render preparation reads it
+/// on other threads while the simulation carries on with the next frame.
+class FrameSnapshot
+{
+public:
+    FrameSnapshot() { }
+    /// Releases the buffer.
+    ~FrameSnapshot();
+
+    /// Copies the columns of the types in mask for every storage that has any of them, replacing the previous contents.
+    /// With a job system the copying is spread over the workers.
+    void Extract(EntityManager* manager, const ComponentBits& mask, uint64_t frame, JobSystem* jobs = 0x0);
+    /// Empties the snapshot, the buffer is kept for the next extraction.
+    void Clear();
+
+    /// Simulation frame that was extracted.
+    uint64_t GetFrame() const { return frame_; }
+    /// Number of entities extracted.
+    size_t GetEntityCount() const { return entityCount_; }
+    const std::vector<SnapshotBlock>& GetBlocks() const { return blocks_; }
+    /// Bytes of copied IDs and states.
+    size_t GetDataSize() const { return dataSize_; }
+
+    /// IDs of a block's entities.
+    const EntityID* GetIDs(const SnapshotBlock& block) const { return (const EntityID*)(data_ + block.idsOffset_); }
+    /// States of a component type in a block, 0x0 if the block's definition doesn't have it or it wasn't extracted.
+    const void* GetStates(const SnapshotBlock& block, CompID typeID) const;
+    /// Typed access to a block's states, T is the Component type.
+    template<typename T>
+    const typename T::State* GetStates(const SnapshotBlock& block) const { return (const typename T::State*)GetStates(block, T::TypeID); }
+
+private:
+    friend class SimWorld;
+
+    /// Makes room for size bytes, growing the buffer without initializing it. The old contents are lost.
+    void Reserve(size_t size);
+
+    /// Copied IDs and columns of all blocks, aligned to PARSECS_MAX_STATE_ALIGNMENT and only ever written by the copies.
+    unsigned char* data_ = 0x0;
+    /// Bytes of data_ in use.
+    size_t dataSize_ = 0;
+    /// Bytes allocated for data_.
+    size_t dataCapacity_ = 0;
+    /// One block per extracted definition.
+    std::vector<SnapshotBlock> blocks_;
+    /// Simulation frame that was extracted.
+    uint64_t frame_ = 0;
+    /// Total entities extracted.
+    size_t entityCount_ = 0;
+    /// Threads holding this snapshot through SimWorld::AcquireSnapshot.
+    std::atomic<int> readers_{ 0 };
+};
\ No newline at end of file
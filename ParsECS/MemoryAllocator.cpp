@@ -1,13 +1,27 @@
 #include "MemoryAllocator.h"
 
+#include "AlignedAllocator.h"
+
 #include <algorithm>
 #include <assert.h>
 
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
 const unsigned char MemoryChunk::PATTERN_ALIGN = 0xFC;
 const unsigned char MemoryChunk::PATTERN_ALLOC = 0xFD;
 const unsigned char MemoryChunk::PATTERN_FREE = 0xFE;
 
-MemoryChunk::MemoryChunk(unsigned short pos, unsigned short length)
+MemoryChunk::MemoryChunk(uint32_t pos, uint32_t length)
 {
     position_ = pos;
     length_ = length;
@@ -15,16 +29,86 @@ MemoryChunk::MemoryChunk(unsigned short pos, unsigned short length)
     used_ = 0;
 }
 
-MemoryPage::MemoryPage(unsigned short pageSize)
+/// Smallest power of two that holds a page, what slab pages from the heap are aligned to.
+static size_t SlabPageAlignment(size_t size)
+{
+    size_t alignment = PARSECS_MAX_STATE_ALIGNMENT;
+    while (alignment < size)
+        alignment <<= 1;
+    return alignment;
+}
+
+/// Obtains the memory of a page, OS sources and slab pages are aligned to their size.
+static void* AllocatePageMemory(size_t size, MemoryPageSource source, bool slab)
+{
+    // Heap pages start on a cache line so first-fit chunks can be aligned cheaply, slab pages are aligned to
+    // their size so that freeing finds the page by masking the block's address
+    if (source == MPS_Heap)
+        return AlignedAllocate(size, slab ? SlabPageAlignment(size) : PARSECS_MAX_STATE_ALIGNMENT);
+
+#if defined(_WIN32)
+    // Find an aligned address inside an oversized reservation, then map exactly there. Another thread may take
+    // the range in between so a few attempts are made.
+    for (int attempt = 0; attempt < 8; ++attempt)
+    {
+        void* probe = VirtualAlloc(0x0, size * 2, MEM_RESERVE, PAGE_NOACCESS);
+        if (!probe)
+            return 0x0;
+        const uintptr_t aligned = ((uintptr_t)probe + size - 1) & ~(uintptr_t)(size - 1);
+        VirtualFree(probe, 0, MEM_RELEASE);
+        if (void* memory = VirtualAlloc((void*)aligned, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE))
+            return memory;
+    }
+    return 0x0;
+#else
+    // Map twice the size and trim the unaligned head and tail
+    void* probe = mmap(0x0, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (probe == MAP_FAILED)
+        return 0x0;
+    const uintptr_t start = (uintptr_t)probe;
+    const uintptr_t aligned = (start + size - 1) & ~(uintptr_t)(size - 1);
+    if (aligned > start)
+        munmap(probe, aligned - start);
+    if (start + size * 2 > aligned + size)
+        munmap((void*)(aligned + size), start + size * 2 - (aligned + size));
+    #if defined(MADV_HUGEPAGE)
+    if (source == MPS_OSHugePages)
+        madvise((void*)aligned, size, MADV_HUGEPAGE);
+    #endif
+    return (void*)aligned;
+#endif
+}
+
+/// Returns the memory of a page.
+static void FreePageMemory(void* memory, size_t size, MemoryPageSource source)
+{
+    if (source == MPS_Heap)
+    {
+        AlignedFree(memory);
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+MemoryPage::MemoryPage(uint32_t pageSize, bool slab, MemoryPageSource source)
 {
     pageSize_ = freeBytes_ = pageSize;
-    address_ = malloc(pageSize);
+    source_ = source;
+    address_ = AllocatePageMemory(pageSize, source, slab);
+    assert(address_);
     usedBytes_ = 0;
     
+#if PARSECS_MEMORY_GUARDS
     // Fill with allocation pattern
     memset(address_, MemoryChunk::PATTERN_ALLOC, pageSize_);
+#endif
 
-    chunks_.insert_tail(new MemoryChunk(0, pageSize));
+    if (!slab)
+        chunks_.insert_tail(new MemoryChunk(0, pageSize));
 }
 
 MemoryPage::~MemoryPage()
@@ -49,7 +133,9 @@ void* MemoryPage::Allocate(size_t size, size_t minimumSize)
             current->position_ += newAllocChunk->length_; //guard byte
             current->length_ -= newAllocChunk->length_; // guard byte
 
+#if PARSECS_MEMORY_GUARDS
             newAllocChunk->writeGuardByte(address_);
+#endif
             newAllocChunk->used_ = 1;
             freeBytes_ -= finalSize;
             usedBytes_ += finalSize;
@@ -65,13 +151,15 @@ void MemoryPage::Free(void* memory)
     auto current = chunks_.head();
     while (current)
     {
-        if (current->used_ == 1 && ((char*)address_ + current->position_) == memory)
+        if (current->used_ == 1 && memory >= current->startAddress(address_) && memory < current->endAddress(address_))
         {
+#if PARSECS_MEMORY_GUARDS
             assert(current->checkGuardByte(address_));
+            current->freeData(address_); // mark data as freed
+#endif
 
             freeBytes_ += current->length_;
             usedBytes_ -= current->length_;
-            current->freeData(address_); // mark data as freed
             current->used_ = 0; // mark node as free
             Coalesce(current);
             return;
@@ -83,10 +171,11 @@ void MemoryPage::Free(void* memory)
 void MemoryPage::Clear()
 {
     if (address_)
-        free(address_);
+        FreePageMemory(address_, pageSize_, source_);
     freeBytes_ = pageSize_;
     usedBytes_ = 0;
     address_ = 0x0;
+    draining_ = false;
     while (chunks_.tail() && chunks_.tail() != chunks_.head())
         delete chunks_.remove_tail();
 }
@@ -130,33 +219,206 @@ void MemoryPage::Clean()
     }
 }
 
-MemoryMan::MemoryMan(unsigned short pageSize, unsigned short minimumBlockSize) :
+void MemoryPage::SetSizeClass(uint32_t sizeClass, uint32_t blockSize)
+{
+    assert(usedBlocks_ == 0 && blockSize <= pageSize_);
+    sizeClass_ = sizeClass;
+    blockSize_ = blockSize;
+    blockCount_ = pageSize_ / blockSize;
+    usedBlocks_ = 0;
+    carved_ = 0;
+    freeBlocks_ = 0x0;
+}
+
+void MemoryPage::ResetBlocks()
+{
+    sizeClass_ = NoSizeClass;
+    draining_ = false;
+    usedBlocks_ = 0;
+    carved_ = 0;
+    freeBlocks_ = 0x0;
+    freeBytes_ = pageSize_;
+    usedBytes_ = 0;
+}
+
+void* MemoryPage::AllocateBlock()
+{
+    void* block = 0x0;
+    if (freeBlocks_)
+    {
+        block = freeBlocks_;
+        freeBlocks_ = *(void**)block;
+    }
+    else if (carved_ + blockSize_ <= pageSize_)
+    {
+        // Untouched blocks are carved off in order, a new page needs no setup pass over its blocks
+        block = (char*)address_ + carved_;
+        carved_ += blockSize_;
+    }
+    else
+        return 0x0;
+
+    ++usedBlocks_;
+    freeBytes_ -= blockSize_;
+    usedBytes_ += blockSize_;
+#if PARSECS_MEMORY_GUARDS
+    memset(block, MemoryChunk::PATTERN_ALLOC, blockSize_ - sizeof(size_t));
+    memset((char*)block + blockSize_ - sizeof(size_t), MemoryChunk::PATTERN_ALIGN, sizeof(size_t));
+#endif
+    return block;
+}
+
+void MemoryPage::FreeBlock(void* memory)
+{
+    assert(usedBlocks_ > 0 && ((char*)memory - (char*)address_) % blockSize_ == 0);
+#if PARSECS_MEMORY_GUARDS
+    assert(memcmp((char*)memory + blockSize_ - sizeof(size_t), &MemoryChunk::PATTERN_ALIGN, sizeof(unsigned char)) == 0);
+    memset(memory, MemoryChunk::PATTERN_FREE, blockSize_);
+#endif
+
+    *(void**)memory = freeBlocks_;
+    freeBlocks_ = memory;
+    --usedBlocks_;
+    freeBytes_ += blockSize_;
+    usedBytes_ -= blockSize_;
+}
+
+MemoryMan::MemoryMan(uint32_t pageSize, uint32_t minimumBlockSize, MemoryMode mode, MemoryPageSource source) :
     pageSize_(pageSize),
-    minimumBlockSize_(minimumBlockSize)
+    minimumBlockSize_(minimumBlockSize),
+    mode_(mode),
+    source_(source)
 {
-    pages_.insert_head(new MemoryPage(pageSize_));
+    assert(source_ == MPS_Heap || (pageSize_ >= 4096 && (pageSize_ & (pageSize_ - 1)) == 0));
+    if (source_ != MPS_Heap)
+        pageMask_ = ~(uintptr_t)(pageSize_ - 1);
+    else if (mode_ == MM_Slab)
+        pageMask_ = ~(uintptr_t)(SlabPageAlignment(pageSize_) - 1);
+    BuildSizeClasses();
+    AddPage();
 }
 
-MemoryMan::MemoryMan(unsigned short pageCount, unsigned short pageSize, unsigned short minimumBlockSize) :
+MemoryMan::MemoryMan(uint32_t pageCount, uint32_t pageSize, uint32_t minimumBlockSize, MemoryMode mode, MemoryPageSource source) :
     pageSize_(pageSize),
-    minimumBlockSize_(minimumBlockSize)
+    minimumBlockSize_(minimumBlockSize),
+    mode_(mode),
+    source_(source)
 {
+    assert(source_ == MPS_Heap || (pageSize_ >= 4096 && (pageSize_ & (pageSize_ - 1)) == 0));
+    if (source_ != MPS_Heap)
+        pageMask_ = ~(uintptr_t)(pageSize_ - 1);
+    else if (mode_ == MM_Slab)
+        pageMask_ = ~(uintptr_t)(SlabPageAlignment(pageSize_) - 1);
+    BuildSizeClasses();
     for (unsigned i = 0; i < pageCount; ++i)
-        pages_.insert_tail(new MemoryPage(pageSize_));
+        AddPage();
 }
 
 MemoryMan::~MemoryMan()
 {
+    // The slab lists unlink their pages when destroyed, empty them before the pages go
+    for (auto& partial : partialPages_)
+        partial.clear();
+    emptyPages_.clear();
+    while (pages_.head())
+        delete pages_.remove_head();
+    pageMap_.clear();
+}
+
+void MemoryMan::BuildSizeClasses()
+{
+    if (mode_ != MM_Slab)
+        return;
+
+    // Blocks are multiples of 16 bytes so every block is as aligned as the page, classes grow by a quarter each
+    // which bounds the waste to ~20%. The last class takes up a whole page.
+    const size_t guard = PARSECS_MEMORY_GUARDS ? sizeof(size_t) : 0;
+    const size_t largest = (pageSize_ & ~(size_t)15) - guard;
+    size_t size = std::max<size_t>(16, ((size_t)minimumBlockSize_ + guard + 15) & ~(size_t)15) - guard;
+    while (size < largest)
+    {
+        sizeClasses_.push_back((uint32_t)size);
+        size = (((size + guard) * 5 / 4 + 15) & ~(size_t)15) - guard;
+    }
+    sizeClasses_.push_back((uint32_t)largest);
+    partialPages_.resize(sizeClasses_.size());
+}
+
+MemoryPage* MemoryMan::AddPage()
+{
+    MemoryPage* page = new MemoryPage(pageSize_, mode_ == MM_Slab, source_);
+    pages_.insert_tail(page);
+    if (pageMask_)
+        pageMap_[(uintptr_t)page->address_] = page;
+    if (mode_ == MM_Slab)
+        emptyPages_.insert_tail(page);
+    return page;
+}
+
+void MemoryMan::RemovePage(MemoryPage* page)
+{
+    if (mode_ == MM_Slab)
+    {
+        if (page->sizeClass_ == MemoryPage::NoSizeClass)
+            emptyPages_.remove(page);
+        else if (!page->IsFull() && !page->draining_)
+            partialPages_[page->sizeClass_].remove(page);
+    }
+    if (pageMask_)
+    {
+        // A first-fit page cleared earlier may share its old address with a newer page
+        auto found = std::find_if(pageMap_.begin(), pageMap_.end(), [=](const std::pair<const uintptr_t, MemoryPage*>& entry) { return entry.second == page; });
+        if (found != pageMap_.end())
+            pageMap_.erase(found);
+    }
+    pages_.remove(page);
+    delete page;
+}
+
+MemoryPage* MemoryMan::FindPage(void* memory)
+{
+    if (pageMask_)
+    {
+        auto found = pageMap_.find((uintptr_t)memory & pageMask_);
+        if (found == pageMap_.end() || !found->second->Contains(memory))
+            return 0x0;
+        return found->second;
+    }
 
+    for (auto page = pages_.head(); page; page = pages_.next(page))
+        if (page->Contains(memory))
+            return page;
+    return 0x0;
+}
+
+void MemoryMan::ResetSlabs()
+{
+    for (auto& partial : partialPages_)
+        partial.clear();
+    emptyPages_.clear();
+    for (auto page = pages_.head(); page; page = pages_.next(page))
+    {
+        page->ResetBlocks();
+        emptyPages_.insert_tail(page);
+    }
 }
 
 void* MemoryMan::Allocate(size_t size)
 {
+    if (mode_ == MM_Slab)
+    {
+        void* block = 0x0;
+        const uint32_t sizeClass = GetSizeClass(size);
+        if (sizeClass != MemoryPage::NoSizeClass)
+            AllocateBlocks(sizeClass, &block, 1);
+        return block;
+    }
+
     auto page = pages_.head();
     while (page)
     {
         // Is the page valid and if so could we even possible fit?
-        if (page->address_ && page->freeBytes_ > std::max(size, (size_t)minimumBlockSize_))
+        if (page->address_ && !page->draining_ && page->freeBytes_ > std::max(size, (size_t)minimumBlockSize_))
         {
             if (void* alloc = page->Allocate(size, minimumBlockSize_))
                 return alloc;
@@ -164,34 +426,166 @@ void* MemoryMan::Allocate(size_t size)
         page = pages_.next(page);
     }
 
-    pages_.insert_tail(new MemoryPage(pageSize_));
-    return pages_.tail()->Allocate(size, minimumBlockSize_);
+    return AddPage()->Allocate(size, minimumBlockSize_);
+}
+
+void* MemoryMan::Allocate(size_t size, size_t alignment)
+{
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+    const size_t guaranteed = mode_ == MM_Slab ? 16 : 1;
+    if (alignment <= guaranteed)
+        return Allocate(size);
+
+    void* memory = Allocate(size + alignment - guaranteed);
+    if (!memory)
+        return 0x0;
+    return (void*)(((uintptr_t)memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+uint32_t MemoryMan::GetSizeClass(size_t size) const
+{
+    auto sizeClass = std::lower_bound(sizeClasses_.begin(), sizeClasses_.end(), std::max(size, (size_t)minimumBlockSize_));
+    if (sizeClass == sizeClasses_.end())
+        return MemoryPage::NoSizeClass;
+    return (uint32_t)(sizeClass - sizeClasses_.begin());
+}
+
+uint32_t MemoryMan::AllocateBlocks(uint32_t sizeClass, void** blocks, uint32_t count)
+{
+    assert(mode_ == MM_Slab && sizeClass < sizeClasses_.size());
+    SlabList& partial = partialPages_[sizeClass];
+    uint32_t taken = 0;
+    while (taken < count)
+    {
+        MemoryPage* page = partial.head();
+        if (!page)
+        {
+            if (emptyPages_.empty())
+                AddPage();
+            page = emptyPages_.remove_head();
+            const size_t guard = PARSECS_MEMORY_GUARDS ? sizeof(size_t) : 0;
+            page->SetSizeClass(sizeClass, (uint32_t)((sizeClasses_[sizeClass] + guard + 15) & ~(size_t)15));
+            partial.insert_head(page);
+        }
+
+        // Drain the page before moving on so batches come from as few pages as possible
+        while (taken < count && !page->IsFull())
+            blocks[taken++] = page->AllocateBlock();
+        if (page->IsFull())
+            partial.remove(page);
+    }
+    return taken;
 }
 
 void* MemoryMan::Free(void* memory)
 {
-    auto page = pages_.head();
-    while (page)
+    if (mode_ == MM_Slab)
     {
-        if (page->Contains(memory))
+        MemoryPage* page = FindPage(memory);
+        if (!page || page->sizeClass_ == MemoryPage::NoSizeClass)
+            return memory;
+
+        // Back to the start of the block in case the address was aligned within it
+        memory = (char*)page->address_ + ((char*)memory - (char*)page->address_) / page->blockSize_ * page->blockSize_;
+        // Draining pages are kept out of the partial lists
+        const bool listed = !page->IsFull() && !page->draining_;
+        page->FreeBlock(memory);
+        if (page->usedBlocks_ == 0)
         {
-            page->Free(memory);
-            return 0x0;
+            // Empty pages go back to the shared pool so that any size class can use them
+            if (listed)
+                partialPages_[page->sizeClass_].remove(page);
+            page->sizeClass_ = MemoryPage::NoSizeClass;
+            page->draining_ = false;
+            emptyPages_.insert_head(page);
         }
-        page = pages_.next(page);
+        else if (!listed && !page->draining_)
+            partialPages_[page->sizeClass_].insert_head(page);
+        return 0x0;
+    }
+
+    if (MemoryPage* page = FindPage(memory))
+    {
+        page->Free(memory);
+        if (page->usedBytes_ == 0)
+            page->draining_ = false;
+        return 0x0;
     }
     return memory;
 }
 
+void MemoryMan::BeginDrain(MemoryPage* page)
+{
+    if (page->draining_ || page->usedBytes_ == 0)
+        return;
+    if (mode_ == MM_Slab && !page->IsFull())
+        partialPages_[page->sizeClass_].remove(page);
+    page->draining_ = true;
+}
+
+void MemoryMan::EndDrain(MemoryPage* page)
+{
+    if (!page->draining_)
+        return;
+    page->draining_ = false;
+    if (mode_ == MM_Slab && !page->IsFull())
+        partialPages_[page->sizeClass_].insert_tail(page);
+}
+
+size_t MemoryMan::ReleaseEmptyPages(size_t keep)
+{
+    size_t released = 0;
+    if (mode_ == MM_Slab)
+    {
+        size_t empty = 0;
+        for (auto page = emptyPages_.head(); page; page = emptyPages_.next(page))
+            ++empty;
+        while (empty > keep && pages_.head() != pages_.tail())
+        {
+            RemovePage(emptyPages_.tail());
+            --empty;
+            ++released;
+        }
+        return released;
+    }
+
+    size_t kept = 0;
+    for (auto page = pages_.head(); page && pages_.head() != pages_.tail();)
+    {
+        MemoryPage* next = pages_.next(page);
+        if (page->usedBytes_ == 0 && ++kept > keep)
+        {
+            RemovePage(page);
+            ++released;
+        }
+        page = next;
+    }
+    return released;
+}
+
 void MemoryMan::Clear()
 {
+    if (mode_ == MM_Slab)
+    {
+        while (pages_.tail() && pages_.tail() != pages_.head())
+            RemovePage(pages_.tail());
+        ResetSlabs();
+        return;
+    }
+
     while (pages_.tail() && pages_.tail() != pages_.head())
-        delete pages_.remove_tail();
+        RemovePage(pages_.tail());
     pages_.head()->Clear();
 }
 
 void MemoryMan::ClearPages()
 {
+    if (mode_ == MM_Slab)
+    {
+        ResetSlabs();
+        return;
+    }
+
     auto head = pages_.head();
     while (head)
     {
@@ -200,10 +594,10 @@ void MemoryMan::ClearPages()
     }
 }
 
-void MemoryMan::SetPageCount(unsigned short pageCount)
+void MemoryMan::SetPageCount(uint32_t pageCount)
 {
     auto head = pages_.head();
-    int ct = 0;
+    uint32_t ct = 0;
     while (head) 
     {
         ++ct;
@@ -212,13 +606,13 @@ void MemoryMan::SetPageCount(unsigned short pageCount)
 
     while (ct > pageCount)
     {
-        delete pages_.remove_tail();
+        RemovePage(pages_.tail());
         --ct;
     }
 
     while (ct < pageCount)
     {
-        pages_.insert_tail(new MemoryPage(pageSize_));
+        AddPage();
         ++ct;
     }
 }
\ No newline at end of file
@@ -3,7 +3,41 @@
 #include "list.h"
 
 #include <cstdint>
+#include <cstring>
 #include <memory>
+#include <unordered_map>
+#include <vector>
+
+/// Guard bytes behind allocations and fill patterns for allocated/freed memory, checked on free.
+/// On by default in debug builds, define as 0 or 1 to override.
+#ifndef PARSECS_MEMORY_GUARDS
+    #if defined(_DEBUG) || !defined(NDEBUG)
+        #define PARSECS_MEMORY_GUARDS 1
+    #else
+        #define PARSECS_MEMORY_GUARDS 0
+    #endif
+#endif
+
+/// Allocation strategy of a MemoryMan.
+enum MemoryMode
+{
+    /// Pages are split first-fit into variable length chunks.
+    MM_FirstFit,
+    /// Each page is carved into fixed blocks of one size class, free blocks are linked through their own memory.
+    MM_Slab,
+};
+
+/// Where the memory of pages comes from.
+enum MemoryPageSource
+{
+    /// The heap, pages can have any size.
+    MPS_Heap,
+    /// Mapped from the OS aligned to the page size, the owning page of a pointer is found by masking its address.
+    /// The page size must be a power of two and a multiple of the OS page size.
+    MPS_OSAligned,
+    /// As MPS_OSAligned and also requests transparent huge pages where the OS offers them (madvise on Linux).
+    MPS_OSHugePages,
+};
 
 struct MemoryChunk
 {
@@ -11,18 +45,18 @@ struct MemoryChunk
     static const unsigned char PATTERN_ALLOC;
     static const unsigned char PATTERN_FREE;
 
-    unsigned short position_;
-    unsigned short length_;
+    uint32_t position_;
+    uint32_t length_;
     unsigned flags_ : 24;
     unsigned used_ : 8;
     list_node<MemoryChunk> instrusiveList_;
 
-    MemoryChunk(unsigned short pos, unsigned short length);
+    MemoryChunk(uint32_t pos, uint32_t length);
 
     inline void* startAddress(void* relativeTo) { return (char*)relativeTo + position_; }
     inline void* endAddress(void* relativeTo, bool withGuard = true) { return (char*)relativeTo + position_ + length_ - (withGuard ? 0 : sizeof(size_t)); }
-    inline bool checkGuardByte(void* relativeTo) { return memcmp((char*)relativeTo + position_ + length_, &PATTERN_ALIGN, sizeof(unsigned char)) == 0; }
-    inline void writeGuardByte(void* relativeTo) { memset((char*)relativeTo + position_ + length_, PATTERN_ALIGN, sizeof(size_t)); }
+    inline bool checkGuardByte(void* relativeTo) { return memcmp(endAddress(relativeTo, false), &PATTERN_ALIGN, sizeof(unsigned char)) == 0; }
+    inline void writeGuardByte(void* relativeTo) { memset(endAddress(relativeTo, false), PATTERN_ALIGN, sizeof(size_t)); }
     inline void freeData(void* relativeTo) { memset((char*)relativeTo + position_, PATTERN_FREE, length_); }
 };
 
@@ -30,13 +64,35 @@ struct MemoryPage
 {
     list_node<MemoryPage> instrusiveList_;
     list<MemoryChunk, &MemoryChunk::instrusiveList_> chunks_;
-    unsigned short pageSize_;
-    unsigned short freeBytes_;
-    unsigned short usedBytes_ = 0;
+    uint32_t pageSize_;
+    uint32_t freeBytes_;
+    uint32_t usedBytes_ = 0;
     void* address_;
+    /// Where address_ came from.
+    MemoryPageSource source_;
+    /// Set while the page is being emptied, no new allocations are placed in it. Cleared once it is empty.
+    bool draining_ = false;
 
-    /// Construct for a given page size
-    MemoryPage(unsigned short pageSize);
+// Slab mode
+    /// Link in the manager's list of pages of the same size class with free blocks, or of empty pages.
+    list_node<MemoryPage> slabList_;
+    /// Size class the page is carved into, NoSizeClass while the page is empty and unassigned.
+    uint32_t sizeClass_ = NoSizeClass;
+    /// Bytes per block, including the guard.
+    uint32_t blockSize_ = 0;
+    /// Number of blocks that fit.
+    uint32_t blockCount_ = 0;
+    /// Number of blocks handed out.
+    uint32_t usedBlocks_ = 0;
+    /// Blocks below this offset have been handed out at least once, the rest of the page is untouched.
+    uint32_t carved_ = 0;
+    /// Head of the freed blocks, each free block starts with the pointer to the next.
+    void* freeBlocks_ = 0x0;
+
+    static const uint32_t NoSizeClass = 0xFFFFFFFF;
+
+    /// Construct for a given page size, slab pages don't use chunks and are aligned to a power of two on the heap too.
+    MemoryPage(uint32_t pageSize, bool slab = false, MemoryPageSource source = MPS_Heap);
     /// Destruct and release everything.
     ~MemoryPage();
 
@@ -57,30 +113,86 @@ struct MemoryPage
 
     /// Iterates thorugh the Page invoking Coalesce on all unallocated nodes to check for the opportunity to collapse.
     void Clean();
+
+    /// Assigns an empty page to a size class.
+    void SetSizeClass(uint32_t sizeClass, uint32_t blockSize);
+    /// Forgets every block of a slab page and unassigns it.
+    void ResetBlocks();
+    /// Takes a block from a slab page, 0x0 if it is full.
+    void* AllocateBlock();
+    /// Returns a block to a slab page.
+    void FreeBlock(void* memory);
+    /// Returns true if a slab page has no free blocks.
+    inline bool IsFull() const { return usedBlocks_ == blockCount_; }
 };
 
 struct MemoryMan
 {  
+    typedef list<MemoryPage, &MemoryPage::slabList_> SlabList;
+
     /// List of all of the pages in the memory manager.
     list<MemoryPage, &MemoryPage::instrusiveList_> pages_;
     /// Specifies the size of pages in the manager.
-    unsigned short pageSize_;
+    uint32_t pageSize_;
     /// Specifies the minimum size of a memory block that may be allocated within in a page.
-    unsigned short minimumBlockSize_;
+    uint32_t minimumBlockSize_;
+    /// Allocation strategy.
+    MemoryMode mode_;
+    /// Where page memory comes from.
+    MemoryPageSource source_;
+    /// Aligned sources and slab mode: the bits of an address that select its page.
+    uintptr_t pageMask_ = 0;
+    /// Aligned sources and slab mode: pages by their masked address.
+    std::unordered_map<uintptr_t, MemoryPage*> pageMap_;
+    /// Slab mode: block size of each size class, ascending.
+    std::vector<uint32_t> sizeClasses_;
+    /// Slab mode: pages of each size class that have free blocks.
+    std::vector<SlabList> partialPages_;
+    /// Slab mode: pages with nothing allocated, reassigned to whichever size class needs a page next.
+    SlabList emptyPages_;
 
-    MemoryMan(unsigned short pageSize, unsigned short minimumBlockSize = 63);
-    MemoryMan(unsigned short pageCount, unsigned short pageSize, unsigned short minimumBlockSize = 63);
+    MemoryMan(uint32_t pageSize, uint32_t minimumBlockSize = 63, MemoryMode mode = MM_FirstFit, MemoryPageSource source = MPS_Heap);
+    MemoryMan(uint32_t pageCount, uint32_t pageSize, uint32_t minimumBlockSize = 63, MemoryMode mode = MM_FirstFit, MemoryPageSource source = MPS_Heap);
     ~MemoryMan();
 
     /// Allocates a block of memory of at least 'size' bytes.
     void* Allocate(size_t size);
+    /// Allocates at least 'size' bytes starting at a multiple of alignment, a power of two.
+    /// Alignments beyond what the mode guarantees (16 for slab, none for first-fit) over-allocate by the difference.
+    void* Allocate(size_t size, size_t alignment);
     /// Frees the given memory, returns 0x0 if freed
     /// Otherwise it returns the given value as it is not contained in here.
+    /// Any address within an allocation frees it, as returned by the aligned Allocate.
     void* Free(void* memory);
     /// Erases all content.
     void Clear();
     /// Clears only the data in the pages, leaves the count of pages pending.
     void ClearPages();
     /// Will add or remove pages until at the desired count.
-    void SetPageCount(unsigned short pageCount);
+    void SetPageCount(uint32_t pageCount);
+
+    /// Slab mode: index of the smallest size class that holds size bytes, MemoryPage::NoSizeClass if none does.
+    uint32_t GetSizeClass(size_t size) const;
+    /// Stops placing allocations in a page so that it empties as its blocks are moved elsewhere and freed.
+    void BeginDrain(MemoryPage* page);
+    /// Lets a page take allocations again.
+    void EndDrain(MemoryPage* page);
+    /// Returns empty pages to the OS until at most keep remain, the last page is always kept. Returns the number released.
+    size_t ReleaseEmptyPages(size_t keep);
+    /// Page that owns an address, 0x0 if none. Constant time for aligned sources and slab mode.
+    MemoryPage* FindPage(void* memory);
+
+    /// Slab mode: takes up to count blocks of a size class, returns how many were written to blocks.
+    /// Blocks are released with Free like any other.
+    uint32_t AllocateBlocks(uint32_t sizeClass, void** blocks, uint32_t count);
+
+private:
+    /// Creates a page and adds it to the lists.
+    MemoryPage* AddPage();
+    /// Unlinks a page from the lists and deletes it.
+    void RemovePage(MemoryPage* page);
+    /// Slab mode: calculates the size classes from the minimum block size up to the page size.
+    void BuildSizeClasses();
+    /// Slab mode: returns every page to the empty list.
+    void ResetSlabs();
 };
\ No newline at end of file
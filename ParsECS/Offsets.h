@@ -1,9 +1,9 @@
 #pragma once
 
+#include "AlignedAllocator.h"
 #include "ComponentCount.h"
 
 #include <cstdint>
-#include <bitset>
 
 static ComponentBits FromBitIndices(const int* bit, int ct)
 {
@@ -37,6 +37,7 @@ template<typename...Args>
 struct ExclusiveScan {
     static const size_t offsets[sizeof...(Args)];
     static const size_t sizes[sizeof...(Args)];
+    static const size_t alignments[sizeof...(Args)];
     static const uint32_t ids[sizeof...(Args)];
 };
 
@@ -45,9 +46,10 @@ struct ScanTypeSize {
     static const size_t sizes[sizeof...(Args)];
 };
 template<typename...Args>
-const size_t ScanTypeSize<Args...>::sizes[sizeof...(Args)] = { sizeof(Args::State)... };
+const size_t ScanTypeSize<Args...>::sizes[sizeof...(Args)] = { sizeof(typename Args::State)... };
 
-static size_t PrefixSumMask(const size_t* sizes, size_t sizeCt, size_t flatIndex, std::bitset<PARSECS_COMPONENT_COUNT> bits, const uint32_t* ids)
+/// Offset of a state when the states of the set bits are packed in bit order, each starting at a multiple of its alignment.
+static size_t PrefixSumMask(const size_t* sizes, const size_t* alignments, size_t sizeCt, size_t flatIndex, const ComponentBits& bits, const uint32_t* ids)
 {
     size_t sum = 0;
     size_t forType = ids[flatIndex];
@@ -55,12 +57,13 @@ static size_t PrefixSumMask(const size_t* sizes, size_t sizeCt, size_t flatIndex
     {
         if (bits[i])
         {
-            if (i == forType)
-                return sum;
             for (unsigned t = 0; t < sizeCt; ++t)
             {
                 if (ids[t] == i)
                 {
+                    sum = AlignUp(sum, alignments[t]);
+                    if (i == forType)
+                        return sum;
                     sum += sizes[t];
                     break;
                 }
@@ -74,10 +77,13 @@ template<typename...Args>
 const uint32_t ExclusiveScan<Args...>::ids[sizeof...(Args)] = { (Args::TypeID)... };
 
 template<typename...Args>
-const size_t ExclusiveScan<Args...>::sizes[sizeof...(Args)] = { sizeof(Args::State)... };
+const size_t ExclusiveScan<Args...>::sizes[sizeof...(Args)] = { sizeof(typename Args::State)... };
 
 template<typename...Args>
-const size_t ExclusiveScan<Args...>::offsets[sizeof...(Args)] = { PrefixSumMask(ExclusiveScan<Args...>::sizes, sizeof...(Args), FlatIndex(ComponentMask<Args...>::ToBitSet(), Args::TypeID), ComponentMask<Args...>::ToBitSet(), ids)... };
+const size_t ExclusiveScan<Args...>::alignments[sizeof...(Args)] = { alignof(typename Args::State)... };
+
+template<typename...Args>
+const size_t ExclusiveScan<Args...>::offsets[sizeof...(Args)] = { PrefixSumMask(ExclusiveScan<Args...>::sizes, ExclusiveScan<Args...>::alignments, sizeof...(Args), FlatIndex(ComponentMask<Args...>::ToBitSet(), Args::TypeID), ComponentMask<Args...>::ToBitSet(), ids)... };
 
 //template<typename...Args>
 //const size_t ExclusiveScan<Args...>::offsets[sizeof...(Args)] = { PrefixSum(ExclusiveScan<Args...>::sizes, FlatIndex(ComponentMask<Args...>::ToBitSet(), Args::TypeID), sizeof...(Args))... };
\ No newline at end of file
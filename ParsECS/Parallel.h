@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../SysHub/JobSystem.h"
+
+#include <cassert>
+#include <thread>
+#include <vector>
+
+/// One instance of scratch state per thread of a JobSystem, for temporaries that kernels reuse between ranges.
+/// The owning thread and every worker get their own instance, so no locking is needed inside a kernel.
+/// Every thread that is not a worker maps to the owner's instance, so only the thread that constructed the
+/// scratch and the workers of its JobSystem may call Get.
+template<typename T>
+class ThreadScratch
+{
+public:
+    /// Construct an instance for each thread that may run jobs, copied from initial. The calling thread becomes the owner.
+    ThreadScratch(JobSystem* jobs, const T& initial = T()) :
+        slots_(jobs ? jobs->GetThreadCount() : 1, Slot{ initial }),
+        owner_(std::this_thread::get_id())
+    {
+    }
+
+    /// Instance of the calling thread.
+    T& Get()
+    {
+        const unsigned index = JobSystem::GetThreadIndex();
+        assert(index < slots_.size());
+        assert((index != 0 || std::this_thread::get_id() == owner_) && "ThreadScratch used from a thread that is neither its owner nor a worker");
+        return slots_[index].item_;
+    }
+
+    /// Number of instances, for combining after the parallel work has finished.
+    size_t GetCount() const { return slots_.size(); }
+    /// Instance of a thread by index, for combining after the parallel work has finished.
+    T& GetAt(size_t index) { return slots_[index].item_; }
+
+private:
+    /// Each instance starts on its own cache line so that threads updating their scratch don't false share.
+    struct alignas(64) Slot
+    {
+        T item_;
+    };
+
+    std::vector<Slot> slots_;
+    std::thread::id owner_;
+};
+
+/// Output slots for the results of parallel ranges. Each range writes only its own slot,
+/// merging concatenates the slots in range order so the result doesn't depend on which thread ran what.
+template<typename T>
+class RangeResults
+{
+public:
+    /// Prepare a slot for each range, existing results are discarded.
+    void Reset(size_t rangeCount)
+    {
+        slots_.resize(rangeCount);
+        for (auto& slot : slots_)
+            slot.clear();
+    }
+
+    /// Slot of a range.
+    std::vector<T>& operator[](size_t rangeIndex) { return slots_[rangeIndex]; }
+
+    /// Appends all results to out in range order.
+    void Merge(std::vector<T>& out) const
+    {
+        size_t total = out.size();
+        for (auto& slot : slots_)
+            total += slot.size();
+        out.reserve(total);
+        for (auto& slot : slots_)
+            out.insert(out.end(), slot.begin(), slot.end());
+    }
+
+private:
+    std::vector< std::vector<T> > slots_;
+};
\ No newline at end of file
@@ -10,7 +10,9 @@
 #include "Entities/Entity.h"
 #include "Components/ComponentRegistry.h"
 
+#include "Entities/EntityManager.h"
 #include "MemoryAllocator.h"
+#include "SimWorld.h"
 
 struct TestCompState
 {
@@ -76,6 +78,22 @@ int _tmain(int argc, _TCHAR* argv[])
 
     TestAllocator();
 
+    // The world doesn't own its managers, they only have to outlive it
+    MemoryMan* memory = new MemoryMan(1, 64 * 1024, 64);
+    SimWorld* world = new SimWorld();
+    EntityManager* entities = new EntityManager(world);
+    world->SetMemoryManager(memory);
+    world->SetEntityManager(entities);
+
+    ComponentBits extracted;
+    extracted.set(TestComp::TypeID);
+    world->SetExtractedComponents(extracted);
+    world->ExtractSnapshot(0);
+
+    delete entities;
+    delete world;
+    delete memory;
+
     const size_t* scan = ExclusiveScan<TestComp, SecondComp>::offsets;
 //    const size_t* secondScan = ExclusiveScan<TestComp, SecondComp>::pos;
 
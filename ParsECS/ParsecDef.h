@@ -6,6 +6,22 @@ typedef uint32_t EntityID;
 typedef uint32_t CompID;
 typedef uint32_t DefID;
 
+/// EntityIDs are slot-map handles, the low bits are the slot index and the high bits are the slot's generation.
+/// A slot is retired rather than reused once its generation would wrap, so a stale handle never resolves again.
+#define PARSECS_ENTITY_INDEX_BITS 22
+#define PARSECS_ENTITY_INDEX_MASK ((1u << PARSECS_ENTITY_INDEX_BITS) - 1)
+#define PARSECS_ENTITY_GENERATION_MASK ((1u << (32 - PARSECS_ENTITY_INDEX_BITS)) - 1)
+
+/// Slot index of an entity handle.
+inline uint32_t EntityIndex(EntityID id) { return id & PARSECS_ENTITY_INDEX_MASK; }
+/// Generation of an entity handle, a handle is stale once its slot's generation has moved on.
+inline uint32_t EntityGeneration(EntityID id) { return id >> PARSECS_ENTITY_INDEX_BITS; }
+/// Construct an entity handle from a slot index and generation.
+inline EntityID MakeEntityID(uint32_t index, uint32_t generation) { return ((generation & PARSECS_ENTITY_GENERATION_MASK) << PARSECS_ENTITY_INDEX_BITS) | (index & PARSECS_ENTITY_INDEX_MASK); }
+
+/// Upper bound of threads that may record into an EntityManager's command buffers at once.
+#define PARSECS_MAX_THREADS 64
+
 #include <assert.h>
 
 #define BEGIN_PARSECS_NS
@@ -1 +1,43 @@
-#include "SimWorld.h"
\ No newline at end of file
+#include "SimWorld.h"
+
+#include <cassert>
+#include <thread>
+
+void SimWorld::ExtractSnapshot(uint64_t frame, JobSystem* jobs)
+{
+    assert(entityManager_);
+    const int front = front_.load();
+    FrameSnapshot& back = snapshots_[front == 0 ? 1 : 0];
+
+    // Render of the frame before last may still be reading, new readers only ever take the front snapshot
+    while (back.readers_.load() != 0)
+        std::this_thread::yield();
+
+    back.Extract(entityManager_, extracted_, frame, jobs);
+    front_.store(front == 0 ? 1 : 0);
+}
+
+const FrameSnapshot* SimWorld::AcquireSnapshot()
+{
+    // Retry if an extraction swapped the front after it was read, the stale snapshot may be about to be overwritten.
+    // Sequentially consistent so the reader count and the front check can't pass each other.
+    for (;;)
+    {
+        const int front = front_.load();
+        if (front < 0)
+            return 0x0;
+        FrameSnapshot& snapshot = snapshots_[front];
+        ++snapshot.readers_;
+        if (front_.load() == front)
+            return &snapshot;
+        --snapshot.readers_;
+    }
+}
+
+void SimWorld::ReleaseSnapshot(const FrameSnapshot* snapshot)
+{
+    if (!snapshot)
+        return;
+    assert(snapshot == &snapshots_[0] || snapshot == &snapshots_[1]);
+    --const_cast<FrameSnapshot*>(snapshot)->readers_;
+}
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "ComponentCount.h"
+#include "FrameSnapshot.h"
+
 #include <vector>
 
 class ComponentManager;
@@ -7,7 +10,9 @@ class ComponentRegistry;
 class EntityDatabase;
 class EntityManager;
 class EntitySystem;
+class JobSystem;
 struct MemoryMan;
+class ThreadCachedMemory;
 
 class SimWorld
 {
@@ -15,11 +20,42 @@ public:
 
     EntityDatabase* GetEntityDatabase() { return 0x0; }
     ComponentRegistry* GetComponentRegistry() { return 0x0; }
-    MemoryMan* GetMemoryManager() { return 0x0; }
+    MemoryMan* GetMemoryManager() { return memoryManager_; }
+    EntityManager* GetEntityManager() { return entityManager_; }
+    /// Sets the source of the storage chunks, must be set before the entity manager creates its first storage. Not owned.
+    void SetMemoryManager(MemoryMan* memory) { memoryManager_ = memory; }
+    /// Per thread cache the storage chunks are allocated through, 0x0 if they come from the memory manager directly.
+    ThreadCachedMemory* GetThreadCachedMemory() { return threadCachedMemory_; }
+    /// Routes chunk allocation through a cache over the memory manager, which must be in slab mode.
+    /// Must be set before the entity manager creates its first storage and outlive it. Not owned.
+    void SetThreadCachedMemory(ThreadCachedMemory* cache) { threadCachedMemory_ = cache; }
+    /// Sets the manager whose entities are simulated and extracted. Not owned.
+    void SetEntityManager(EntityManager* manager) { entityManager_ = manager; }
+
+// Render extraction, the simulation fills one snapshot while render preparation reads the other
+    /// Component types copied into snapshots.
+    void SetExtractedComponents(const ComponentBits& mask) { extracted_ = mask; }
+    const ComponentBits& GetExtractedComponents() const { return extracted_; }
+    /// Copies the extracted columns into the back snapshot and makes it the front one. Call between simulation frames.
+    /// Waits for readers still holding the back snapshot from two extractions ago, the copying is spread over the job system if given.
+    void ExtractSnapshot(uint64_t frame, JobSystem* jobs = 0x0);
+    /// Holds the latest snapshot for reading, it won't be overwritten until released. 0x0 before the first extraction.
+    const FrameSnapshot* AcquireSnapshot();
+    /// Releases a snapshot obtained from AcquireSnapshot.
+    void ReleaseSnapshot(const FrameSnapshot* snapshot);
 
 private:
     std::vector<EntitySystem*> systems_;
-    EntityManager* entityManager_;
-    ComponentManager* componentManager_;
-    MemoryMan* memoryManager_;
+    EntityManager* entityManager_ = 0x0;
+    ComponentManager* componentManager_ = 0x0;
+    /// Source of the storage chunks for entity states.
+    MemoryMan* memoryManager_ = 0x0;
+    /// Optional per thread cache in front of memoryManager_.
+    ThreadCachedMemory* threadCachedMemory_ = 0x0;
+    /// Component types copied into snapshots.
+    ComponentBits extracted_;
+    /// Double-buffered snapshots.
+    FrameSnapshot snapshots_[2];
+    /// Index of the snapshot readers get, -1 before the first extraction.
+    std::atomic<int> front_{ -1 };
 };
\ No newline at end of file
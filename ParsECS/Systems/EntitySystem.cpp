@@ -14,4 +14,11 @@ EntitySystem::~EntitySystem()
 {
     if (concerns_)
         concerns_->RemoveSystem(this);
+}
+
+bool EntitySystem::ConflictsWith(const EntitySystem* other) const
+{
+    if (IsExclusive() || other->IsExclusive())
+        return true;
+    return writes_.Intersects(other->writes_) || writes_.Intersects(other->reads_) || other->writes_.Intersects(reads_);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "../Aspect.h"
 #include "../ConcernedList.h"
 #include "../Entities/Entity.h"
+#include "../Offsets.h"
 
 #include <vector>
 
@@ -17,7 +18,78 @@ public:
     ConcernedList* GetConcerns() { return concerns_; }
     const ConcernedList* GetConcerns() const { return concerns_; }
 
+    /// Executes the system for a frame, may run on a worker thread concurrently with systems that don't conflict.
+    virtual void Update(float timeStep) { }
+
+// Access declarations, the SystemManager runs systems whose declared accesses don't conflict concurrently
+    /// Declares component types whose states the system reads.
+    template<typename...TList>
+    void Reads() { reads_ |= ComponentMask<TList...>::BitSet; ++scheduleVersion_; }
+    /// Declares component types whose states the system writes.
+    template<typename...TList>
+    void Writes() { writes_ |= ComponentMask<TList...>::BitSet; ++scheduleVersion_; }
+    /// Exclusive systems never run alongside another system. Systems that declare no access are treated as exclusive.
+    void SetExclusive(bool state) { exclusive_ = state; ++scheduleVersion_; }
+    bool IsExclusive() const { return exclusive_ || (reads_.none() && writes_.none()); }
+    /// Returns true if the two systems may not run at the same time.
+    bool ConflictsWith(const EntitySystem* other) const;
+
+    /// The system starts only after the given system has finished.
+    void RunAfter(EntitySystem* other) { runAfter_.push_back(other); ++scheduleVersion_; }
+    /// The given system starts only after this system has finished.
+    void RunBefore(EntitySystem* other) { other->RunAfter(this); }
+
+// Time slicing, budgeted systems are run over their concerned list in slices and resume where they stopped the next frame
+    /// Gives the system a per-frame budget in microseconds, 0 runs it through Update without a budget.
+    /// Budgeted systems need a concerned list and are run through UpdateEntities instead of Update.
+    void SetFrameBudget(uint32_t microseconds) { frameBudget_ = microseconds; }
+    uint32_t GetFrameBudget() const { return frameBudget_; }
+    /// Number of entities passed to each UpdateEntities call, the budget is checked between calls.
+    void SetSliceSize(uint32_t count) { sliceSize_ = count ? count : 1; }
+    uint32_t GetSliceSize() const { return sliceSize_; }
+    /// Position in the concerned list where the next slice starts.
+    /// A pass starts over when the list had entries removed or reordered since it began, so no entity is skipped.
+    /// Lists that change every frame should be sorted rarely or given a budget that covers them in a few frames.
+    size_t GetSliceCursor() const { return sliceCursor_; }
+
+    /// Processes a run of the concerned list for a budgeted system. Structural changes must go through
+    /// a CommandBuffer, the list must not change while a frame's slices run.
+    virtual void UpdateEntities(float timeStep, const ConcernedEntity* entities, size_t count) { }
+    /// Called when a budgeted system reaches the end of its list, every entry was visited at least once during the pass.
+    virtual void PassCompleted() { }
+
+    /// Change version the system last ran at, pass to a View to only visit chunks changed since. 0 before the first run.
+    uint32_t GetLastRunVersion() const { return lastRunVersion_; }
+
+    const ComponentBits& GetReads() const { return reads_; }
+    const ComponentBits& GetWrites() const { return writes_; }
+    const std::vector<EntitySystem*>& GetRunAfter() const { return runAfter_; }
+    /// Bumped whenever the accesses or constraints change, the SystemManager rebuilds its graph when it differs.
+    uint32_t GetScheduleVersion() const { return scheduleVersion_; }
+
 protected:
+    friend class SystemManager;
+
     /// The list of concerned entities is potentially shared
-    ConcernedList* concerns_;
+    ConcernedList* concerns_ = 0x0;
+    /// Component types read.
+    ComponentBits reads_;
+    /// Component types written.
+    ComponentBits writes_;
+    /// Must not overlap any other system.
+    bool exclusive_ = false;
+    /// Systems that must finish before this one starts.
+    std::vector<EntitySystem*> runAfter_;
+    /// Per-frame budget in microseconds, 0 if unbudgeted.
+    uint32_t frameBudget_ = 0;
+    /// Entities per UpdateEntities call.
+    uint32_t sliceSize_ = 64;
+    /// Where the next slice starts, maintained by the SystemManager.
+    size_t sliceCursor_ = 0;
+    /// Modification count of the concerned list when the cursor was last valid.
+    uint32_t sliceModification_ = 0;
+    /// Change version of the previous run, set by the SystemManager.
+    uint32_t lastRunVersion_ = 0;
+    /// Counts changes to the accesses and constraints, bump it when modifying them directly.
+    uint32_t scheduleVersion_ = 0;
 };
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "SystemManager.h"
+
+#include "EntitySystem.h"
+#include "../Entities/EntityManager.h"
+#include "../../SysHub/JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+
+SystemManager::SystemManager()
+{
+}
+
+SystemManager::~SystemManager()
+{
+}
+
+void SystemManager::AddSystem(EntitySystem* system)
+{
+    assert(system);
+    if (std::find(systems_.begin(), systems_.end(), system) == systems_.end())
+    {
+        systems_.push_back(system);
+        graphDirty_ = true;
+    }
+}
+
+void SystemManager::RemoveSystem(EntitySystem* system)
+{
+    auto found = std::find(systems_.begin(), systems_.end(), system);
+    if (found != systems_.end())
+    {
+        systems_.erase(found);
+        graphDirty_ = true;
+    }
+}
+
+bool SystemManager::IsGraphStale() const
+{
+    if (graphDirty_ || builtVersions_.size() != systems_.size())
+        return true;
+    for (size_t i = 0; i < systems_.size(); ++i)
+        if (systems_[i]->GetScheduleVersion() != builtVersions_[i])
+            return true;
+    return false;
+}
+
+void SystemManager::BuildGraph()
+{
+    graphDirty_ = false;
+    builtVersions_.resize(systems_.size());
+    for (size_t i = 0; i < systems_.size(); ++i)
+        builtVersions_[i] = systems_[i]->GetScheduleVersion();
+    cycleSystems_.clear();
+
+    // Topological order of the explicit constraints, picking the earliest added system that is ready each step
+    const size_t count = systems_.size();
+    std::vector<uint32_t> blockers(count, 0);
+    std::vector<std::vector<uint32_t> > unblocks(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (auto other : systems_[i]->GetRunAfter())
+        {
+            auto found = std::find(systems_.begin(), systems_.end(), other);
+            if (found == systems_.end())
+                continue;
+            unblocks[found - systems_.begin()].push_back((uint32_t)i);
+            ++blockers[i];
+        }
+    }
+
+    std::vector<uint32_t> order;
+    std::vector<bool> placed(count, false);
+    order.reserve(count);
+    size_t settled = 0;
+    while (settled < count)
+    {
+        size_t next = 0;
+        while (next < count && (placed[next] || blockers[next]))
+            ++next;
+
+        if (next == count)
+        {
+            // Every remaining system is blocked, drop the ones that can reach themselves so that the systems
+            // merely waiting on them still run
+            std::vector<uint32_t> cycle;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (placed[i])
+                    continue;
+                std::vector<bool> visited(count, false);
+                std::vector<uint32_t> stack(unblocks[i]);
+                bool reached = false;
+                while (!stack.empty() && !reached)
+                {
+                    const uint32_t at = stack.back();
+                    stack.pop_back();
+                    if (placed[at] || visited[at])
+                        continue;
+                    visited[at] = true;
+                    reached = at == i;
+                    stack.insert(stack.end(), unblocks[at].begin(), unblocks[at].end());
+                }
+                if (reached)
+                    cycle.push_back((uint32_t)i);
+            }
+            assert(!cycle.empty());
+
+            for (auto member : cycle)
+            {
+                cycleSystems_.push_back(systems_[member]);
+                placed[member] = true;
+                for (auto u : unblocks[member])
+                    --blockers[u];
+            }
+            settled += cycle.size();
+            continue;
+        }
+
+        placed[next] = true;
+        order.push_back((uint32_t)next);
+        ++settled;
+        for (auto u : unblocks[next])
+            --blockers[u];
+    }
+
+    // The nodes hold atomics and can't be moved, so the graph is sized once and filled in place
+    std::vector<SystemNode> nodes(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        nodes[i].system_ = systems_[order[i]];
+
+    // Edges run forward in the execution order: explicit constraints plus every conflicting pair
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        for (size_t j = i + 1; j < nodes.size(); ++j)
+        {
+            EntitySystem* later = nodes[j].system_;
+            const auto& after = later->GetRunAfter();
+            const bool constrained = std::find(after.begin(), after.end(), nodes[i].system_) != after.end();
+            if (constrained || nodes[i].system_->ConflictsWith(later))
+            {
+                nodes[i].successors_.push_back((uint32_t)j);
+                ++nodes[j].predecessorCount_;
+            }
+        }
+    }
+    nodes_.swap(nodes);
+    assert(cycleSystems_.empty() && "Cycle in system RunAfter constraints, see GetCycleSystems");
+}
+
+void SystemManager::Update(float timeStep)
+{
+    if (IsGraphStale())
+        BuildGraph();
+
+    // Structural changes made while systems run are deferred and applied together once all of them have finished
+    if (entityManager_)
+        entityManager_->Begin();
+
+    if (!jobs_)
+    {
+        for (auto& node : nodes_)
+            RunSystem(node.system_, timeStep);
+    }
+    else
+    {
+        for (auto& node : nodes_)
+            node.remaining_.store(node.predecessorCount_, std::memory_order_relaxed);
+
+        JobCounter frame;
+        for (uint32_t i = 0; i < nodes_.size(); ++i)
+            if (nodes_[i].predecessorCount_ == 0)
+                Schedule(i, timeStep, &frame);
+        jobs_->Wait(&frame);
+    }
+
+    if (entityManager_)
+    {
+        entityManager_->End();
+        entityManager_->ResolvePending();
+    }
+    RunTasks();
+}
+
+void SystemManager::RunTasks()
+{
+#if defined(PARSECS_COROUTINES)
+    // Indexed because a resumed task may start others, those first run next frame
+    const size_t count = tasks_.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (tasks_[i].IsReady())
+            tasks_[i].Resume();
+    }
+
+    tasks_.erase(std::remove_if(tasks_.begin(), tasks_.end(), [](const SystemTask& task) { return task.IsDone(); }), tasks_.end());
+#endif
+}
+
+#if defined(PARSECS_COROUTINES)
+void SystemManager::StartTask(SystemTask&& task)
+{
+    if (!task.IsDone())
+        tasks_.push_back(std::move(task));
+}
+#endif
+
+void SystemManager::RunSystem(EntitySystem* system, float timeStep)
+{
+    const uint32_t version = entityManager_ ? entityManager_->AdvanceChangeVersion() : 0;
+    if (system->GetFrameBudget() && system->GetConcerns())
+        RunSliced(system, timeStep);
+    else
+        system->Update(timeStep);
+    if (entityManager_)
+        system->lastRunVersion_ = version;
+}
+
+void SystemManager::RunSliced(EntitySystem* system, float timeStep)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(system->GetFrameBudget());
+
+    const ConcernedList* list = system->GetConcerns();
+    const size_t size = list->size();
+    // Removals and sorts move entries across the cursor, the pass starts over rather than skip some of them
+    if (system->sliceModification_ != list->GetModificationCount())
+    {
+        system->sliceModification_ = list->GetModificationCount();
+        system->sliceCursor_ = 0;
+    }
+
+    // At least one slice runs every frame so that a system can't starve behind a budget too small for it
+    while (system->sliceCursor_ < size)
+    {
+        const size_t count = std::min<size_t>(system->GetSliceSize(), size - system->sliceCursor_);
+        system->UpdateEntities(timeStep, list->data() + system->sliceCursor_, count);
+        system->sliceCursor_ += count;
+
+        if (system->sliceCursor_ == size)
+        {
+            system->sliceCursor_ = 0;
+            system->PassCompleted();
+            break;
+        }
+        if (Clock::now() >= deadline)
+            break;
+    }
+}
+
+void SystemManager::Schedule(uint32_t index, float timeStep, JobCounter* frame)
+{
+    jobs_->Run([this, index, timeStep, frame]() {
+        SystemNode& node = nodes_[index];
+        RunSystem(node.system_, timeStep);
+
+        // The last predecessor to finish queues the successor
+        for (auto successor : node.successors_)
+            if (nodes_[successor].remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                Schedule(successor, timeStep, frame);
+    }, frame);
+}
\ No newline at end of file
@@ -1,17 +1,98 @@
 #pragma once
 
+#include "SystemTask.h"
+
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
+class EntityManager;
 class EntitySystem;
+class JobSystem;
+struct JobCounter;
 
+/// Owns the frame's EntitySystems and schedules them.
+/// The systems are ordered by their RunAfter constraints, ties keep the order they were added in. The graph is
+/// rebuilt only when systems are added or removed or their accesses or constraints change. Systems whose
+/// constraints form a cycle are left out of the graph, see GetCycleSystems.
+/// Systems whose declared reads/writes conflict run in that order, all others may run concurrently on the JobSystem.
+/// Systems with a frame budget are time sliced: they process their concerned list until the budget is spent and
+/// continue from there the next frame, so a heavy low priority system can't stretch the frame.
 class SystemManager
 {
 public:
     SystemManager();
     virtual ~SystemManager();
 
+    /// Adds a system, the manager does not take ownership.
+    void AddSystem(EntitySystem* system);
+    /// Removes a system.
+    void RemoveSystem(EntitySystem* system);
+    const std::vector<EntitySystem*>& GetSystems() const { return systems_; }
+    /// Systems left out of the graph because their RunAfter constraints form a cycle, they don't run until it is broken.
+    /// Updated whenever the graph is rebuilt, debug builds assert when it isn't empty.
+    const std::vector<EntitySystem*>& GetCycleSystems() const { return cycleSystems_; }
+
+    /// Sets the scheduler used to run systems in parallel, without one the systems run serially in dependency order.
+    void SetJobSystem(JobSystem* jobs) { jobs_ = jobs; }
+    JobSystem* GetJobSystem() const { return jobs_; }
+    /// Sets the manager whose change version advances for each system run, systems then see their GetLastRunVersion.
+    /// The manager is locked while the systems run, their structural changes and command buffers are resolved afterwards.
+    void SetEntityManager(EntityManager* manager) { entityManager_ = manager; }
+    EntityManager* GetEntityManager() const { return entityManager_; }
+
+    /// Rebuilds the dependency graph if it is stale and executes every system once, returning when all have finished and
+    /// the pending structural changes have been resolved. Coroutine tasks whose waits are satisfied are resumed afterwards on the calling thread.
+    void Update(float timeStep);
 
+#if defined(PARSECS_COROUTINES)
+    /// Takes ownership of a task, it first runs during the next Update.
+    void StartTask(SystemTask&& task);
+    /// Number of tasks that haven't finished.
+    size_t GetTaskCount() const { return tasks_.size(); }
+#endif
 
 private:
+    /// Node of the dependency graph.
+    struct SystemNode
+    {
+        EntitySystem* system_ = 0x0;
+        /// Positions in nodes_ of the systems that wait on this one.
+        std::vector<uint32_t> successors_;
+        /// Number of predecessors.
+        uint32_t predecessorCount_ = 0;
+        /// Predecessors still running this frame.
+        std::atomic<uint32_t> remaining_;
+    };
+
+    /// Returns true if the graph no longer matches the systems.
+    bool IsGraphStale() const;
+    /// Orders the systems and calculates the edges between conflicting ones.
+    void BuildGraph();
+    /// Updates a system at a fresh change version and records it as the system's last run.
+    void RunSystem(EntitySystem* system, float timeStep);
+    /// Runs slices of a budgeted system until its budget is spent or its list is finished.
+    void RunSliced(EntitySystem* system, float timeStep);
+    /// Queues a node whose predecessors have all finished.
+    void Schedule(uint32_t node, float timeStep, JobCounter* frame);
+    /// Resumes the ready tasks and releases the finished ones.
+    void RunTasks();
+
     std::vector<EntitySystem*> systems_;
+    /// Graph in execution order, sized once per build because the nodes can't be moved.
+    std::vector<SystemNode> nodes_;
+    /// Schedule version of each system when the graph was built, parallel to systems_.
+    std::vector<uint32_t> builtVersions_;
+    /// Set when systems are added or removed.
+    bool graphDirty_ = true;
+    /// Systems dropped from the graph by a RunAfter cycle.
+    std::vector<EntitySystem*> cycleSystems_;
+    /// Scheduler for the parallel execution.
+    JobSystem* jobs_ = 0x0;
+    /// Source of the change versions.
+    EntityManager* entityManager_ = 0x0;
+#if defined(PARSECS_COROUTINES)
+    /// Running coroutine tasks in the order they were started.
+    std::vector<SystemTask> tasks_;
+#endif
 };
\ No newline at end of file
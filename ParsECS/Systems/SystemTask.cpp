@@ -0,0 +1,134 @@
+#include "SystemTask.h"
+
+#if defined(PARSECS_COROUTINES)
+
+#include "../../SysHub/JobSystem.h"
+
+#include <cassert>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/// Recycles coroutine frames in size classes, blocks are only returned to the heap at exit.
+struct TaskFramePool
+{
+    /// Granularity of the size classes.
+    static const size_t ClassSize = 128;
+    /// Frames larger than ClassSize * ClassCount go straight to the heap.
+    static const size_t ClassCount = 32;
+
+    struct FreeBlock
+    {
+        FreeBlock* next_;
+    };
+
+    ~TaskFramePool()
+    {
+        for (auto& head : free_)
+        {
+            while (head)
+            {
+                FreeBlock* next = head->next_;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    static size_t ClassOf(size_t size) { return (size + ClassSize - 1) / ClassSize - 1; }
+
+    void* Allocate(size_t size)
+    {
+        const size_t sizeClass = ClassOf(size);
+        if (sizeClass >= ClassCount)
+            return ::operator new(size);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (FreeBlock* block = free_[sizeClass])
+            {
+                free_[sizeClass] = block->next_;
+                return block;
+            }
+        }
+        return ::operator new((sizeClass + 1) * ClassSize);
+    }
+
+    void Free(void* memory, size_t size)
+    {
+        const size_t sizeClass = ClassOf(size);
+        if (sizeClass >= ClassCount)
+        {
+            ::operator delete(memory);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        FreeBlock* block = (FreeBlock*)memory;
+        block->next_ = free_[sizeClass];
+        free_[sizeClass] = block;
+    }
+
+    std::mutex mutex_;
+    FreeBlock* free_[ClassCount] = { };
+};
+
+static TaskFramePool& GetFramePool()
+{
+    static TaskFramePool pool;
+    return pool;
+}
+
+void SystemTask::promise_type::unhandled_exception()
+{
+    assert(0 && "Unhandled exception in SystemTask");
+    std::terminate();
+}
+
+void* SystemTask::promise_type::operator new(size_t size)
+{
+    return GetFramePool().Allocate(size);
+}
+
+void SystemTask::promise_type::operator delete(void* memory, size_t size)
+{
+    GetFramePool().Free(memory, size);
+}
+
+void SystemTask::ReserveFrames(size_t frameSize, size_t count)
+{
+    std::vector<void*> frames(count);
+    for (auto& frame : frames)
+        frame = GetFramePool().Allocate(frameSize);
+    for (auto frame : frames)
+        GetFramePool().Free(frame, frameSize);
+}
+
+bool SystemTask::IsReady() const
+{
+    if (IsDone())
+        return false;
+
+    const promise_type& promise = handle_.promise();
+    if (promise.wait_ == TW_Job)
+        return !promise.counter_ || promise.counter_->IsDone();
+    return true;
+}
+
+void SystemTask::Resume()
+{
+    assert(!IsDone());
+    promise_type& promise = handle_.promise();
+    promise.wait_ = TW_None;
+    promise.counter_ = 0x0;
+    promise.resumed_ = std::chrono::steady_clock::now();
+    handle_.resume();
+}
+
+bool Job::await_ready() const noexcept
+{
+    return !counter_ || counter_->IsDone();
+}
+
+#endif
\ No newline at end of file
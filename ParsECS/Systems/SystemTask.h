@@ -0,0 +1,131 @@
+#pragma once
+
+// Coroutine system tasks need C++20, define PARSECS_NO_COROUTINES to leave them out
+#if defined(__cpp_impl_coroutine) && !defined(PARSECS_NO_COROUTINES)
+    #define PARSECS_COROUTINES 1
+#endif
+
+#if defined(PARSECS_COROUTINES)
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+struct JobCounter;
+
+/// What a suspended SystemTask is waiting for.
+enum TaskWait
+{
+    TW_None,
+    TW_NextFrame,
+    TW_Job,
+};
+
+/// Long-running system logic written as a coroutine, spread over frames without a hand-written state machine:
+///
+///     SystemTask StageSpawns(EntityManager* manager)
+///     {
+///         for (int wave = 0; wave < 10; ++wave)
+///         {
+///             SpawnWave(manager, wave);
+///             co_await NextFrame();
+///         }
+///     }
+///     systemManager->StartTask(StageSpawns(manager));
+///
+/// Tasks are resumed by the SystemManager on its calling thread after the frame's systems have finished.
+/// Coroutine frames come from a pool of recycled blocks, after warm up starting a task doesn't allocate.
+class SystemTask
+{
+public:
+    struct promise_type
+    {
+        SystemTask get_return_object() { return SystemTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        /// Tasks start suspended, the scheduler runs the first step.
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        /// Kept alive after finishing so the scheduler sees done() before destroying it.
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception();
+
+        static void* operator new(size_t size);
+        static void operator delete(void* memory, size_t size);
+
+        /// What the task is suspended on.
+        TaskWait wait_ = TW_None;
+        /// Counter awaited for TW_Job.
+        JobCounter* counter_ = 0x0;
+        /// When the task was last resumed, used by Budget.
+        std::chrono::steady_clock::time_point resumed_;
+    };
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    SystemTask() { }
+    explicit SystemTask(Handle handle) : handle_(handle) { }
+    SystemTask(SystemTask&& rhs) noexcept : handle_(rhs.handle_) { rhs.handle_ = 0x0; }
+    SystemTask& operator=(SystemTask&& rhs) noexcept { std::swap(handle_, rhs.handle_); return *this; }
+    SystemTask(const SystemTask&) = delete;
+    SystemTask& operator=(const SystemTask&) = delete;
+    /// Destroys the coroutine frame if still owned.
+    ~SystemTask() { if (handle_) handle_.destroy(); }
+
+    /// Returns true if the task has run to completion or holds no coroutine.
+    bool IsDone() const { return !handle_ || handle_.done(); }
+    /// Returns true if the task's wait has been satisfied and it can be resumed.
+    bool IsReady() const;
+    /// Resumes the task until its next suspension.
+    void Resume();
+
+    /// Pre-allocates pooled frames so that starting up to count tasks with frames of frameSize bytes won't allocate.
+    static void ReserveFrames(size_t frameSize, size_t count);
+
+private:
+    Handle handle_ = 0x0;
+};
+
+/// Suspends the task until the next frame.
+struct NextFrame
+{
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(SystemTask::Handle handle) noexcept { handle.promise().wait_ = TW_NextFrame; }
+    void await_resume() const noexcept { }
+};
+
+/// Suspends the task until the next frame only if it has run for more than the given microseconds since it was resumed,
+/// checked inside loops to cap a task's share of the frame.
+struct Budget
+{
+    explicit Budget(uint32_t microseconds) : microseconds_(microseconds) { }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(SystemTask::Handle handle) noexcept
+    {
+        auto& promise = handle.promise();
+        if (std::chrono::steady_clock::now() - promise.resumed_ < std::chrono::microseconds(microseconds_))
+            return false;
+        promise.wait_ = TW_NextFrame;
+        return true;
+    }
+    void await_resume() const noexcept { }
+
+    uint32_t microseconds_;
+};
+
+/// Suspends the task until a job counter reaches zero, checked once per frame.
+struct Job
+{
+    explicit Job(JobCounter* counter) : counter_(counter) { }
+
+    bool await_ready() const noexcept;
+    void await_suspend(SystemTask::Handle handle) noexcept
+    {
+        handle.promise().wait_ = TW_Job;
+        handle.promise().counter_ = counter_;
+    }
+    void await_resume() const noexcept { }
+
+    JobCounter* counter_;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "ThreadCachedMemory.h"
+
+#include "MemoryAllocator.h"
+
+#include "../SysHub/SysDef.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    /// Recently used cache of a thread, thread locals have to be POD.
+    struct CacheSlot
+    {
+        uint64_t ownerID_;
+        void* cache_;
+    };
+
+    /// Number of ThreadCachedMemory instances a thread finds without taking a lock.
+    const unsigned SlotCount = 4;
+}
+
+static SYS_THREAD_LOCAL CacheSlot threadSlots_[SlotCount];
+static SYS_THREAD_LOCAL unsigned threadNextSlot_ = 0;
+
+std::atomic<uint64_t> ThreadCachedMemory::nextID_(1);
+
+/// Layout in front of every returned address.
+struct ThreadBlockHeader
+{
+    uint32_t sizeClass_;
+    /// Distance from the start of the block to the returned address, larger than HeaderSize for aligned allocations.
+    uint32_t offset_;
+};
+
+static_assert(sizeof(ThreadBlockHeader) <= ThreadCachedMemory::HeaderSize, "Block header doesn't fit");
+
+ThreadCachedMemory::ThreadCachedMemory(MemoryMan* central, size_t batchBytes) :
+    central_(central),
+    id_(nextID_++)
+{
+    assert(central_ && central_->mode_ == MM_Slab);
+    batches_.resize(central_->sizeClasses_.size());
+    for (size_t i = 0; i < batches_.size(); ++i)
+        batches_[i] = (uint32_t)std::min<size_t>(MaxBatch, std::max<size_t>(1, batchBytes / central_->sizeClasses_[i]));
+}
+
+ThreadCachedMemory::~ThreadCachedMemory()
+{
+    FlushAll();
+    for (auto& entry : caches_)
+        delete entry.second;
+    caches_.clear();
+}
+
+ThreadCachedMemory::ThreadCache* ThreadCachedMemory::GetCache()
+{
+    for (unsigned i = 0; i < SlotCount; ++i)
+    {
+        if (threadSlots_[i].ownerID_ == id_)
+            return (ThreadCache*)threadSlots_[i].cache_;
+    }
+
+    ThreadCache* cache;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ThreadCache*& entry = caches_[std::this_thread::get_id()];
+        if (!entry)
+        {
+            entry = new ThreadCache();
+            entry->lists_.resize(batches_.size());
+        }
+        cache = entry;
+    }
+
+    CacheSlot& slot = threadSlots_[threadNextSlot_++ % SlotCount];
+    slot.ownerID_ = id_;
+    slot.cache_ = cache;
+    return cache;
+}
+
+void* ThreadCachedMemory::Allocate(size_t size)
+{
+    return Allocate(size, 16);
+}
+
+void* ThreadCachedMemory::Allocate(size_t size, size_t alignment)
+{
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+    // Blocks are 16 byte aligned, so is the address behind the header
+    if (alignment > 16)
+        size += alignment - 16;
+
+    // The size classes are fixed once the central manager is constructed, reading them needs no lock
+    const uint32_t sizeClass = central_->GetSizeClass(size + HeaderSize);
+    if (sizeClass == MemoryPage::NoSizeClass)
+        return 0x0;
+
+    ClassList& list = GetCache()->lists_[sizeClass];
+    if (!list.head_ && !Refill(list, sizeClass))
+        return 0x0;
+
+    char* block = (char*)list.head_;
+    list.head_ = *(void**)(block + HeaderSize);
+    --list.count_;
+
+    // The header always sits right in front of the returned address so Free finds the block from it
+    char* memory = block + HeaderSize;
+    if (alignment > 16)
+        memory = (char*)(((uintptr_t)memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    ThreadBlockHeader* header = (ThreadBlockHeader*)(memory - HeaderSize);
+    header->sizeClass_ = sizeClass;
+    header->offset_ = (uint32_t)(memory - block);
+    return memory;
+}
+
+void ThreadCachedMemory::Free(void* memory)
+{
+    if (!memory)
+        return;
+
+    const ThreadBlockHeader* header = (const ThreadBlockHeader*)((char*)memory - HeaderSize);
+    const uint32_t sizeClass = header->sizeClass_;
+    char* block = (char*)memory - header->offset_;
+    memory = block + HeaderSize;
+    assert(sizeClass < batches_.size());
+
+    ClassList& list = GetCache()->lists_[sizeClass];
+    *(void**)memory = list.head_;
+    list.head_ = block;
+    ++list.count_;
+
+    // Keep up to two batches so alternating allocations and frees don't trade with the central manager every time
+    if (list.count_ > batches_[sizeClass] * 2)
+        Flush(list, batches_[sizeClass]);
+}
+
+bool ThreadCachedMemory::Refill(ClassList& list, uint32_t sizeClass)
+{
+    void* blocks[MaxBatch];
+    uint32_t count;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        count = central_->AllocateBlocks(sizeClass, blocks, batches_[sizeClass]);
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        *(void**)((char*)blocks[i] + HeaderSize) = list.head_;
+        list.head_ = blocks[i];
+    }
+    list.count_ += count;
+    return count != 0;
+}
+
+void ThreadCachedMemory::Flush(ClassList& list, uint32_t count)
+{
+    // Unlink outside of the lock, the blocks are only touched by this thread until they are freed centrally
+    void* blocks[MaxBatch];
+    uint32_t taken = 0;
+    while (taken < count && taken < MaxBatch && list.head_)
+    {
+        blocks[taken++] = list.head_;
+        list.head_ = *(void**)((char*)list.head_ + HeaderSize);
+    }
+    list.count_ -= taken;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t i = 0; i < taken; ++i)
+        central_->Free(blocks[i]);
+}
+
+void ThreadCachedMemory::FlushThread()
+{
+    ThreadCache* cache = GetCache();
+    for (auto& list : cache->lists_)
+    {
+        while (list.head_)
+            Flush(list, MaxBatch);
+    }
+}
+
+void ThreadCachedMemory::FlushAll()
+{
+    std::vector<ThreadCache*> caches;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& entry : caches_)
+            caches.push_back(entry.second);
+    }
+
+    for (auto cache : caches)
+    {
+        for (auto& list : cache->lists_)
+        {
+            while (list.head_)
+                Flush(list, MaxBatch);
+        }
+    }
+}
\ No newline at end of file
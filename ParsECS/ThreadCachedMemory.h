@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct MemoryMan;
+
+/// Lets any number of threads allocate from one slab mode MemoryMan.
+/// Every thread keeps lists of free blocks per size class and only takes the lock of the central manager to refill
+/// or flush a list, a batch of blocks at a time. Blocks may be freed on any thread, the freeing thread's cache adopts
+/// them which keeps producer/consumer patterns such as spawning on one thread and destroying on another lock free
+/// until a list overflows.
+class ThreadCachedMemory
+{
+public:
+    /// Construct over a slab mode manager which must outlive this. Batches move about batchBytes at once, but always
+    /// at least one and at most MaxBatch blocks.
+    ThreadCachedMemory(MemoryMan* central, size_t batchBytes = 64 * 1024);
+    /// Returns every cached block to the central manager, no thread may be using the caches anymore.
+    ~ThreadCachedMemory();
+
+    /// Allocates a block of at least size bytes, 0x0 if size exceeds the largest size class.
+    void* Allocate(size_t size);
+    /// Allocates at least size bytes starting at a multiple of alignment, a power of two.
+    /// Alignments beyond 16 over-allocate by the difference.
+    void* Allocate(size_t size, size_t alignment);
+    /// Frees a block obtained from Allocate on any thread.
+    void Free(void* memory);
+
+    /// Returns the blocks cached by the calling thread to the central manager. Threads that stop allocating
+    /// for good should call this so their blocks don't stay cached.
+    void FlushThread();
+    /// Returns the blocks cached by all threads to the central manager, no other thread may be using the caches.
+    void FlushAll();
+
+    /// Manager the caches trade with.
+    MemoryMan* GetCentral() const { return central_; }
+
+    /// Most blocks moved to or from the central manager at once.
+    static const uint32_t MaxBatch = 64;
+    /// Bytes in front of every block, keeps the blocks 16 byte aligned.
+    static const size_t HeaderSize = 16;
+
+private:
+    /// Free blocks of one size class, linked through the first bytes after their header.
+    struct ClassList
+    {
+        void* head_ = 0x0;
+        uint32_t count_ = 0;
+    };
+
+    /// Free blocks of one thread.
+    struct ThreadCache
+    {
+        std::vector<ClassList> lists_;
+    };
+
+    /// Cache of the calling thread, created on first use.
+    ThreadCache* GetCache();
+    /// Takes a batch of a size class from the central manager, returns false if none were available.
+    bool Refill(ClassList& list, uint32_t sizeClass);
+    /// Returns up to count blocks of a list to the central manager.
+    void Flush(ClassList& list, uint32_t count);
+
+    /// Shared manager, guarded by mutex_.
+    MemoryMan* central_;
+    /// Blocks per refill and flush for each size class.
+    std::vector<uint32_t> batches_;
+    /// Identifies this instance in the threads' lookup slots, never reused.
+    uint64_t id_;
+    /// Guards central_ and caches_.
+    std::mutex mutex_;
+    /// Cache of every thread that used this.
+    std::unordered_map<std::thread::id, ThreadCache*> caches_;
+
+    /// Source of id_.
+    static std::atomic<uint64_t> nextID_;
+};
\ No newline at end of file
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "ComponentCount.h"
+#include "Offsets.h"
+#include "Entities/EntityManager.h"
+#include "Entities/EntityStorage.h"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/// View term: the component state is passed to the function as a const reference.
+template<typename T>
+struct Read { };
+
+/// View term: the component state is passed to the function as a mutable reference.
+template<typename T>
+struct Write { };
+
+/// View term: definitions that have any of these components are skipped, nothing is passed to the function.
+template<typename...TList>
+struct Exclude { };
+
+/// View filter: requires T and skips chunks whose T column was not written at or after the view's since-version.
+/// Filtering is per chunk, every entity of a chunk that passes is visited.
+template<typename T>
+struct Changed { };
+
+/// View filter: requires T and skips chunks that received no new T states at or after the view's since-version.
+/// States are new when the entity is created or promoted from a definition without T.
+template<typename T>
+struct Added { };
+
+/// Compile-time description of a view term.
+template<typename TERM>
+struct ViewTerm;
+
+template<typename T>
+struct ViewTerm< Read<T> >
+{
+    static const bool Accessed = true;
+    typedef const typename T::State* Pointer;
+
+    static void AddRequired(ComponentBits& bits) { bits |= ComponentMask<T>::BitSet; }
+    static void AddExcluded(ComponentBits&) { }
+    static uint32_t Offset(const ChunkLayout& layout) { return layout.columnOffset_[T::TypeID]; }
+    static Pointer Column(StorageChunk* chunk, uint32_t offset) { return (Pointer)((unsigned char*)chunk + offset); }
+    static bool Accept(StorageChunk*, uint32_t) { return true; }
+    static void Stamp(StorageChunk*, uint32_t) { }
+};
+
+template<typename T>
+struct ViewTerm< Write<T> >
+{
+    static const bool Accessed = true;
+    typedef typename T::State* Pointer;
+
+    static void AddRequired(ComponentBits& bits) { bits |= ComponentMask<T>::BitSet; }
+    static void AddExcluded(ComponentBits&) { }
+    static uint32_t Offset(const ChunkLayout& layout) { return layout.columnOffset_[T::TypeID]; }
+    static Pointer Column(StorageChunk* chunk, uint32_t offset) { return (Pointer)((unsigned char*)chunk + offset); }
+    static bool Accept(StorageChunk*, uint32_t) { return true; }
+    static void Stamp(StorageChunk* chunk, uint32_t version) { chunk->MarkChanged(T::TypeID, version); }
+};
+
+template<typename...TList>
+struct ViewTerm< Exclude<TList...> >
+{
+    static const bool Accessed = false;
+    typedef void* Pointer;
+
+    static void AddRequired(ComponentBits&) { }
+    static void AddExcluded(ComponentBits& bits) { bits |= ComponentMask<TList...>::BitSet; }
+    static uint32_t Offset(const ChunkLayout&) { return 0; }
+    static Pointer Column(StorageChunk*, uint32_t) { return 0x0; }
+    static bool Accept(StorageChunk*, uint32_t) { return true; }
+    static void Stamp(StorageChunk*, uint32_t) { }
+};
+
+template<typename T>
+struct ViewTerm< Changed<T> >
+{
+    static const bool Accessed = false;
+    typedef void* Pointer;
+
+    static void AddRequired(ComponentBits& bits) { bits |= ComponentMask<T>::BitSet; }
+    static void AddExcluded(ComponentBits&) { }
+    static uint32_t Offset(const ChunkLayout&) { return 0; }
+    static Pointer Column(StorageChunk*, uint32_t) { return 0x0; }
+    static bool Accept(StorageChunk* chunk, uint32_t since) { return ChangedSince(chunk->GetChangedVersions()[chunk->layout_->flatIndex_[T::TypeID]], since); }
+    static void Stamp(StorageChunk*, uint32_t) { }
+};
+
+template<typename T>
+struct ViewTerm< Added<T> >
+{
+    static const bool Accessed = false;
+    typedef void* Pointer;
+
+    static void AddRequired(ComponentBits& bits) { bits |= ComponentMask<T>::BitSet; }
+    static void AddExcluded(ComponentBits&) { }
+    static uint32_t Offset(const ChunkLayout&) { return 0; }
+    static Pointer Column(StorageChunk*, uint32_t) { return 0x0; }
+    static bool Accept(StorageChunk* chunk, uint32_t since) { return ChangedSince(chunk->GetAddedVersions()[chunk->layout_->flatIndex_[T::TypeID]], since); }
+    static void Stamp(StorageChunk*, uint32_t) { }
+};
+
+/// Builds an index_sequence of the positions of the terms that are passed to the function.
+template<size_t I, typename SEQ, typename...TERMS>
+struct ViewAccessedIndices;
+
+template<size_t I, size_t...IS>
+struct ViewAccessedIndices<I, std::index_sequence<IS...> >
+{
+    typedef std::index_sequence<IS...> Type;
+};
+
+template<size_t I, size_t...IS, typename HEAD, typename...TAIL>
+struct ViewAccessedIndices<I, std::index_sequence<IS...>, HEAD, TAIL...>
+{
+    typedef typename std::conditional<ViewTerm<HEAD>::Accessed,
+        typename ViewAccessedIndices<I + 1, std::index_sequence<IS..., I>, TAIL...>::Type,
+        typename ViewAccessedIndices<I + 1, std::index_sequence<IS...>, TAIL...>::Type>::type Type;
+};
+
+/// Typed iteration over the chunked storage of every definition that matches the terms.
+/// Matching and column offsets are resolved once per definition, the function is invoked directly
+/// with a reference for each Read/Write term in the order they are listed:
+///
+///     View<Read<Velocity>, Write<Position>, Exclude<Frozen> > view(manager);
+///     view.Each([](const Velocity::State& vel, Position::State& pos) { ... });
+///
+/// Chunks visited through a Write term are stamped with the manager's change version. Given a since-version,
+/// typically EntitySystem::GetLastRunVersion(), Changed/Added filters skip chunks that weren't touched since then:
+///
+///     View<Read<Position>, Changed<Position> > moved(manager, GetLastRunVersion());
+template<typename...TERMS>
+class View
+{
+public:
+    static const size_t TermCount = sizeof...(TERMS);
+    typedef std::tuple<typename ViewTerm<TERMS>::Pointer...> Columns;
+    typedef typename ViewAccessedIndices<0, std::index_sequence<>, TERMS...>::Type AccessedIndices;
+
+    /// Construct for the entities of a manager, Changed/Added filters accept chunks stamped at or after sinceVersion.
+    View(EntityManager* manager, uint32_t sinceVersion = 0) : manager_(manager), sinceVersion_(sinceVersion) { }
+
+    /// Components that a definition must have.
+    static const ComponentBits& GetRequired() { static const ComponentBits bits = BuildRequired(); return bits; }
+    /// Components that a definition must not have.
+    static const ComponentBits& GetExcluded() { static const ComponentBits bits = BuildExcluded(); return bits; }
+
+    /// Returns true if entities of the given layout are visited by this view.
+    static bool Matches(const ChunkLayout& layout)
+    {
+        return layout.mask_.Contains(GetRequired()) && !layout.mask_.Intersects(GetExcluded());
+    }
+
+    /// Invokes function(states...) for every matching entity.
+    template<typename FN>
+    void Each(FN&& function)
+    {
+        EachChunk([&](StorageChunk* chunk, const Columns& columns) {
+            InvokeChunk(chunk->count_, columns, function, AccessedIndices());
+        });
+    }
+
+    /// Invokes function(EntityID, states...) for every matching entity.
+    template<typename FN>
+    void EachWithID(FN&& function)
+    {
+        EachChunk([&](StorageChunk* chunk, const Columns& columns) {
+            InvokeChunkWithID(chunk->GetIDs(), chunk->count_, columns, function, AccessedIndices());
+        });
+    }
+
+    /// Invokes function(StorageChunk*, const Columns&) for every non-empty chunk of a matching definition that passes the filters.
+    /// Columns holds a typed pointer to the first state of each term, useful for hand vectorized loops.
+    template<typename FN>
+    void EachChunk(FN&& function)
+    {
+        const uint32_t version = manager_->GetChangeVersion();
+        for (EntityStorage* storage : manager_->GetStorages())
+        {
+            if (!storage || !storage->GetEntityCount() || !Matches(*storage->GetLayout()))
+                continue;
+
+            const uint32_t offsets[] = { ViewTerm<TERMS>::Offset(*storage->GetLayout())..., 0 };
+            for (size_t c = 0; c < storage->GetChunkCount(); ++c)
+            {
+                StorageChunk* chunk = storage->GetChunk(c);
+                if (!chunk->count_ || !Accept(chunk, sinceVersion_))
+                    continue;
+                Stamp(chunk, version);
+                function(chunk, MakeColumns(chunk, offsets, std::index_sequence_for<TERMS...>()));
+            }
+        }
+    }
+
+private:
+    static ComponentBits BuildRequired()
+    {
+        ComponentBits bits;
+        int expand[] = { 0, (ViewTerm<TERMS>::AddRequired(bits), 0)... };
+        (void)expand;
+        return bits;
+    }
+
+    static ComponentBits BuildExcluded()
+    {
+        ComponentBits bits;
+        int expand[] = { 0, (ViewTerm<TERMS>::AddExcluded(bits), 0)... };
+        (void)expand;
+        return bits;
+    }
+
+    static bool Accept(StorageChunk* chunk, uint32_t since)
+    {
+        const bool accepted[] = { true, ViewTerm<TERMS>::Accept(chunk, since)... };
+        for (bool term : accepted)
+            if (!term)
+                return false;
+        return true;
+    }
+
+    static void Stamp(StorageChunk* chunk, uint32_t version)
+    {
+        int expand[] = { 0, (ViewTerm<TERMS>::Stamp(chunk, version), 0)... };
+        (void)expand;
+    }
+
+    template<size_t...IS>
+    static Columns MakeColumns(StorageChunk* chunk, const uint32_t* offsets, std::index_sequence<IS...>)
+    {
+        return Columns(ViewTerm<TERMS>::Column(chunk, offsets[IS])...);
+    }
+
+    template<typename FN, size_t...IS>
+    static void InvokeChunk(uint32_t count, const Columns& columns, FN& function, std::index_sequence<IS...>)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+            function(std::get<IS>(columns)[i]...);
+    }
+
+    template<typename FN, size_t...IS>
+    static void InvokeChunkWithID(const EntityID* ids, uint32_t count, const Columns& columns, FN& function, std::index_sequence<IS...>)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+            function(ids[i], std::get<IS>(columns)[i]...);
+    }
+
+    /// Manager whose storages are iterated.
+    EntityManager* manager_;
+    /// Changed/Added filters accept chunks stamped at or after this version, 0 accepts all.
+    uint32_t sinceVersion_;
+};
@@ -0,0 +1,198 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+static SYS_THREAD_LOCAL unsigned threadIndex_ = 0;
+
+JobSystem::JobSystem(unsigned workerCount) :
+    queued_(0),
+    running_(true)
+{
+    if (workerCount == 0)
+    {
+        const unsigned hardware = std::thread::hardware_concurrency();
+        workerCount = hardware > 1 ? hardware - 1 : 1;
+    }
+
+    for (unsigned i = 0; i <= workerCount; ++i)
+        queues_.push_back(new WorkQueue());
+    for (unsigned i = 1; i <= workerCount; ++i)
+        workers_.push_back(std::thread(&JobSystem::WorkerMain, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+    // Drain anything still queued so that counters being waited on elsewhere complete
+    while (TryRunOne())
+        ;
+
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        wake_.notify_all();
+    }
+    for (auto& worker : workers_)
+        worker.join();
+    workers_.clear();
+
+    for (auto queue : queues_)
+        delete queue;
+    queues_.clear();
+}
+
+unsigned JobSystem::GetThreadIndex()
+{
+    return threadIndex_;
+}
+
+void JobSystem::Run(JobFunction function, JobCounter* counter, JobCounter* dependency)
+{
+    if (counter)
+        counter->count_.fetch_add(1, std::memory_order_relaxed);
+
+    Job job = { std::move(function), counter };
+    if (dependency && !dependency->IsDone())
+    {
+        // Checked again under the lock, Finish takes the same lock before releasing dependents
+        std::lock_guard<std::mutex> lock(dependency->mutex_);
+        if (!dependency->IsDone())
+        {
+            dependency->waiting_.push_back(std::move(job));
+            return;
+        }
+    }
+    Push(std::move(job));
+}
+
+void JobSystem::Wait(JobCounter* counter)
+{
+    assert(counter);
+    while (!counter->IsDone())
+    {
+        if (!TryRunOne())
+            std::this_thread::yield();
+    }
+
+    // The final decrement happens under the lock, once it is acquired here Finish no longer touches the counter
+    std::lock_guard<std::mutex> lock(counter->mutex_);
+}
+
+void JobSystem::ParallelFor(size_t begin, size_t end, size_t grain, RangeFunction function)
+{
+    if (begin >= end)
+        return;
+
+    const size_t count = end - begin;
+    if (grain == 0)
+        grain = std::max<size_t>(1, count / (GetThreadCount() * 4));
+    if (count <= grain)
+    {
+        function(begin, end);
+        return;
+    }
+
+    // The first range is kept for the calling thread, the rest are offered to the workers
+    JobCounter counter;
+    for (size_t start = begin + grain; start < end; start += grain)
+    {
+        const size_t stop = std::min(end, start + grain);
+        Run([&function, start, stop]() { function(start, stop); }, &counter);
+    }
+    function(begin, begin + grain);
+    Wait(&counter);
+}
+
+void JobSystem::WorkerMain(unsigned index)
+{
+    threadIndex_ = index;
+    while (running_.load(std::memory_order_relaxed))
+    {
+        if (TryRunOne())
+            continue;
+
+        // Park until work arrives, the timeout covers a wake that lands between the check and the wait
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        wake_.wait_for(lock, std::chrono::milliseconds(1), [this]() { return queued_.load(std::memory_order_relaxed) > 0 || !running_; });
+    }
+}
+
+void JobSystem::Push(Job&& job)
+{
+    WorkQueue* queue = queues_[threadIndex_ < queues_.size() ? threadIndex_ : 0];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex_);
+        queue->jobs_.push_back(std::move(job));
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    wake_.notify_one();
+}
+
+bool JobSystem::TryRunOne()
+{
+    const size_t queueCount = queues_.size();
+    const size_t self = threadIndex_ < queueCount ? threadIndex_ : 0;
+    Job job;
+    bool found = false;
+
+    // Own work newest first, it is the most likely to still be in cache
+    {
+        WorkQueue* queue = queues_[self];
+        std::lock_guard<std::mutex> lock(queue->mutex_);
+        if (!queue->jobs_.empty())
+        {
+            job = std::move(queue->jobs_.back());
+            queue->jobs_.pop_back();
+            found = true;
+        }
+    }
+
+    // Steal the oldest work of the other threads, oldest jobs tend to be the largest
+    for (size_t i = 1; !found && i < queueCount; ++i)
+    {
+        WorkQueue* queue = queues_[(self + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue->mutex_);
+        if (!queue->jobs_.empty())
+        {
+            job = std::move(queue->jobs_.front());
+            queue->jobs_.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    Execute(job);
+    return true;
+}
+
+void JobSystem::Execute(Job& job)
+{
+    if (job.function_)
+        job.function_();
+    if (job.counter_)
+        Finish(job.counter_);
+}
+
+void JobSystem::Finish(JobCounter* counter)
+{
+    // Decrements that can't complete the counter don't need the lock
+    int current = counter->count_.load(std::memory_order_relaxed);
+    while (current > 1)
+    {
+        if (counter->count_.compare_exchange_weak(current, current - 1, std::memory_order_acq_rel))
+            return;
+    }
+
+    std::vector<Job> released;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex_);
+        if (counter->count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            released.swap(counter->waiting_);
+    }
+    for (auto& job : released)
+        Push(std::move(job));
+}
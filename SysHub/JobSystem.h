@@ -0,0 +1,103 @@
+#pragma once
+
+#include "SysDef.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> JobFunction;
+/// Function for a range [begin, end) of a parallel-for.
+typedef std::function<void(size_t, size_t)> RangeFunction;
+
+/// Tracks outstanding jobs. Every job queued against a counter increments it, completion decrements it.
+/// Jobs may depend on a counter, they are held back until it reaches zero.
+/// A counter must outlive its jobs and must not be reused until it has reached zero.
+struct SYS_EXPORT JobCounter
+{
+    JobCounter() : count_(0) { }
+
+    /// Returns true if all jobs of the counter have finished.
+    bool IsDone() const { return count_.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+
+    struct PendingJob
+    {
+        JobFunction function_;
+        JobCounter* counter_;
+    };
+
+    /// Number of unfinished jobs.
+    std::atomic<int> count_;
+    /// Guards waiting_.
+    std::mutex mutex_;
+    /// Jobs that depend on this counter and are released once it reaches zero.
+    std::vector<PendingJob> waiting_;
+};
+
+/// Work-stealing job scheduler.
+/// Each worker thread owns a deque, it takes its own work newest first and steals the oldest work of others when empty.
+/// Threads that wait on a counter execute jobs while they wait instead of blocking.
+class SYS_EXPORT JobSystem
+{
+public:
+    /// Construct and start the workers, 0 uses one worker per hardware thread less the calling thread.
+    JobSystem(unsigned workerCount = 0);
+    /// Finishes queued work and joins the workers.
+    ~JobSystem();
+
+    /// Queues a job. If counter is given it is incremented now and decremented when the job completes.
+    /// If dependency is given the job does not start before that counter reaches zero.
+    void Run(JobFunction function, JobCounter* counter = 0x0, JobCounter* dependency = 0x0);
+    /// Executes jobs on the calling thread until the counter reaches zero.
+    void Wait(JobCounter* counter);
+    /// Splits [begin, end) into ranges of at most grain indices and runs them in parallel, returning when all are done.
+    /// A grain of 0 picks a size that gives each thread a few ranges to balance with.
+    void ParallelFor(size_t begin, size_t end, size_t grain, RangeFunction function);
+
+    /// Number of worker threads, not counting threads that help while waiting.
+    unsigned GetWorkerCount() const { return (unsigned)workers_.size(); }
+    /// Number of threads that may execute jobs at once, workers plus the calling thread.
+    unsigned GetThreadCount() const { return (unsigned)workers_.size() + 1; }
+    /// Index of the calling thread, 0 for the main or any non-worker thread and 1..GetWorkerCount() for workers.
+    static unsigned GetThreadIndex();
+
+private:
+    typedef JobCounter::PendingJob Job;
+
+    /// Deque of one thread, the owner uses the back while thieves take from the front.
+    struct WorkQueue
+    {
+        std::mutex mutex_;
+        std::deque<Job> jobs_;
+    };
+
+    /// Entry point of worker threads.
+    void WorkerMain(unsigned index);
+    /// Pushes a runnable job onto the calling thread's queue and wakes a worker.
+    void Push(Job&& job);
+    /// Takes a job from the calling thread's queue or steals one, then runs it. Returns false if no work was found.
+    bool TryRunOne();
+    /// Runs a job and completes its counter.
+    void Execute(Job& job);
+    /// Decrements a counter, releasing its dependents when it reaches zero.
+    void Finish(JobCounter* counter);
+
+    /// One queue per thread index, queue 0 is shared by all non-worker threads.
+    std::vector<WorkQueue*> queues_;
+    /// Worker threads.
+    std::vector<std::thread> workers_;
+    /// Number of jobs sitting in queues, used to park idle workers.
+    std::atomic<int> queued_;
+    /// Cleared to stop the workers.
+    std::atomic<bool> running_;
+    /// Idle workers sleep on this.
+    std::mutex wakeMutex_;
+    std::condition_variable wake_;
+};
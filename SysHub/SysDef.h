@@ -2,7 +2,7 @@
 
 #include <cstdint>
 
-#ifdef SYS_HUB_EXPORT
+#if defined(SYS_HUB_EXPORT) || defined(SYSHUB_EXPORTS)
     #define SYS_EXPORT __declspec(dllexport)
 #else
     #define SYS_EXPORT
@@ -10,4 +10,11 @@
 
 #define Kilobytes(VALUE) (VALUE * 1024)
 #define Megabytes(VALUE) (Kilobytes(VALUE) * 1024)
-#define Gigabytes(VALUE) (Megabytes((uint64_t)VALUE) * 1024)
\ No newline at end of file
+#define Gigabytes(VALUE) (Megabytes((uint64_t)VALUE) * 1024)
+
+/// Thread local storage for POD values, VS2013 lacks the thread_local keyword.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+    #define SYS_THREAD_LOCAL __declspec(thread)
+#else
+    #define SYS_THREAD_LOCAL thread_local
+#endif
\ No newline at end of file